@@ -8,6 +8,15 @@ static u8 sig_eq(char sig[4], const char *expect) {
             sig[2] == expect[2] && sig[3] == expect[3]);
 }
 
+static void acpi_register(struct ACPISDTHeader *entry) {
+    if (sig_eq(entry->signature, "APIC"))
+        acpi_tables.madt = (struct MADT *)entry;
+    else if (sig_eq(entry->signature, "FACP"))
+        acpi_tables.fadt = (struct FADT *)entry;
+    else if (sig_eq(entry->signature, "HPET"))
+        acpi_tables.hpet = (struct HPET *)entry;
+}
+
 void init_acpi(struct RSDP *rsdp) {
     acpi_tables.rsdp = rsdp;
 
@@ -20,9 +29,7 @@ void init_acpi(struct RSDP *rsdp) {
         if (xsdp->xsdt != 0) {
             u64 num_entries = (xsdt->h.length - sizeof(xsdt->h)) / 8;
             for (u64 i = 0; i < num_entries; i++) {
-                struct ACPISDTHeader *entry = PHYS_TO_VIRT(xsdt->SDTptrs[i]);
-                if (sig_eq(entry->signature, "APIC"))
-                    acpi_tables.madt = (struct MADT *)entry;
+                acpi_register(PHYS_TO_VIRT(xsdt->SDTptrs[i]));
             }
         }
     } else {
@@ -31,9 +38,7 @@ void init_acpi(struct RSDP *rsdp) {
 
         u32 num_entries = (rsdt->h.length - sizeof(rsdt->h)) / 4;
         for (u32 i = 0; i < num_entries; i++) {
-            struct ACPISDTHeader *entry = PHYS_TO_VIRT((u64)rsdt->SDTptrs[i]);
-            if (sig_eq(entry->signature, "APIC"))
-                acpi_tables.madt = (struct MADT *)entry;
+            acpi_register(PHYS_TO_VIRT((u64)rsdt->SDTptrs[i]));
         }
     }
 }
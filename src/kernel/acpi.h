@@ -7,6 +7,8 @@ struct acpi_tables {
     struct RSDT *rsdt;
     struct XSDT *xsdt;
     struct MADT *madt;
+    struct FADT *fadt;
+    struct HPET *hpet;
 };
 
 extern struct acpi_tables acpi_tables;
@@ -105,13 +107,21 @@ struct MADT {
     u8 entries[];
 };
 
+#define ACPI_SPACE_MEMORY 0
+#define ACPI_SPACE_IO     1
+
 struct GenericAddressStructure {
     u8 AddressSpace;
     u8 BitWidth;
     u8 BitOffset;
     u8 AccessSize;
     u64 Address;
-};
+} __attribute__((packed));
+
+// FADT flags
+#define FADT_TMR_VAL_EXT (1 << 8)   // PM timer is 32 bits wide, not 24
+// FADT length up to and including X_PMTimerBlock
+#define FADT_X_PM_TMR_END 220
 
 struct FADT {
     struct ACPISDTHeader h;
@@ -166,7 +176,16 @@ struct FADT {
     struct GenericAddressStructure X_PMTimerBlock;
     struct GenericAddressStructure X_GPE0Block;
     struct GenericAddressStructure X_GPE1Block;
-};
+} __attribute__((packed));
+
+struct HPET {
+    struct ACPISDTHeader h;
+    u32 event_timer_block_id;
+    struct GenericAddressStructure address;
+    u8 hpet_number;
+    u16 minimum_tick;
+    u8 page_protection;
+} __attribute__((packed));
 
 struct XSDT {
     struct ACPISDTHeader h;
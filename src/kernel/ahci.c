@@ -303,6 +303,16 @@ static int ahci_submit(struct blk_device *dev, struct blk_request *req) {
     return 0;
 }
 
+// blk_ops.abort callback: stopping the port drops the commands it holds,
+// so their DMA cannot land after the caller has given up on the buffer
+static void ahci_abort(struct blk_device *dev) {
+    struct hba_port *port = (struct hba_port *)dev->priv;
+    ahci_port_stop(port);
+    port->serr = port->serr;
+    ahci_port_clear_interrupts(port);
+    ahci_port_start(port);
+}
+
 // ============================================================================
 // IRQ handler (called from vector 48 — AHCI MSI)
 // ============================================================================
@@ -383,7 +393,7 @@ void ahci_init(void) {
 
                 char name[BLK_NAME_LEN] = "ahci0";
                 name[4] = '0' + i;
-                struct blk_ops ops = { .submit = ahci_submit };
+                struct blk_ops ops = { .submit = ahci_submit, .abort = ahci_abort };
                 port_blk[i] = blk_register(name, ops,
                                             port_info[port_num].sector_size, port);
                 if (port_blk[i])
@@ -1,9 +1,11 @@
 #include "apic.h"
 #include "acpi.h"
+#include "clock.h"
 #include "mem.h"
 #include "x86.h"
 #include "print.h"
 #include "pit.h"
+#include "spinlock.h"
 
 static volatile u32 *lapic_base;
 static volatile u32 *ioapic_base;
@@ -93,6 +95,75 @@ u32 lapic_id(void) {
     return lapic_read(LAPIC_ID) >> 24;
 }
 
+#define CPUID_TOPO_LEVEL_SMT   1
+#define CPUID_CACHE_TYPE_NONE  0
+
+/* Bits needed for n distinct values */
+static u32 count_bits(u32 n)
+{
+    u32 b = 0;
+    while ((1U << b) < n) b++;
+    return b;
+}
+
+/* Shift that leaves the ID of the level-`level` cache in the x2APIC ID,
+   from deterministic cache parameters (leaf 4, or 0x8000001D on AMD);
+   -1 if the cache is not reported */
+static i32 cache_shift(u32 leaf, u32 level)
+{
+    for (u32 i = 0; i < 16; i++) {
+        u32 eax;
+        cpuid(leaf, i, &eax, 0, 0, 0);
+        if ((eax & 0x1F) == CPUID_CACHE_TYPE_NONE) break;
+        if (((eax >> 5) & 7) == level)
+            return (i32)count_bits(((eax >> 14) & 0xFFF) + 1);
+    }
+    return -1;
+}
+
+/* Leaf 0x1F (or 0xB) splits the x2APIC ID into SMT, core ... package
+   fields; without it every CPU counts as its own core in one package. */
+void cpu_topology_detect(void) {
+    struct cpu *c = mycpu();
+    u32 max, max_ext, ebx;
+    cpuid(0, 0, &max, 0, 0, 0);
+    cpuid(0x80000000, 0, &max_ext, 0, 0, 0);
+    cpuid(1, 0, 0, &ebx, 0, 0);
+
+    u32 id = ebx >> 24, smt_shift = 0, pkg_shift = 8;
+    u32 leaf = 0, eax, ecx, edx;
+    if (max >= 0x1F) {
+        cpuid(0x1F, 0, 0, &ebx, 0, 0);
+        if (ebx) leaf = 0x1F;
+    }
+    if (!leaf && max >= 0xB) {
+        cpuid(0xB, 0, 0, &ebx, 0, 0);
+        if (ebx) leaf = 0xB;
+    }
+    for (u32 i = 0; leaf; i++) {
+        cpuid(leaf, i, &eax, 0, &ecx, &edx);
+        u32 type = (ecx >> 8) & 0xFF;
+        if (!type) break;
+        id = edx;
+        if (type == CPUID_TOPO_LEVEL_SMT) smt_shift = eax & 0x1F;
+        pkg_shift = eax & 0x1F;     /* the last level's shift */
+    }
+
+    i32 l2 = -1, llc = -1;
+    for (u32 cl = 3; cl >= 2; cl--) {
+        i32 s = max >= 4 ? cache_shift(4, cl) : -1;
+        if (s < 0 && max_ext >= 0x8000001D) s = cache_shift(0x8000001D, cl);
+        if (s >= 0 && llc < 0) llc = s;
+        if (cl == 2) l2 = s;
+    }
+
+    c->x2apic_id = id;
+    c->core_id   = id >> smt_shift;
+    c->pkg_id    = id >> pkg_shift;
+    c->l2_id     = l2 >= 0 ? id >> l2 : c->core_id;
+    c->llc_id    = llc >= 0 ? id >> llc : c->pkg_id;
+}
+
 void ioapic_init(void) {
     struct MADT *madt = acpi_tables.madt;
     if (!madt) {
@@ -194,8 +265,16 @@ void pit_stop(void) {
 }
 
 // LAPIC Timer
-#define LAPIC_TIMER_PERIODIC 0x20000
-#define LAPIC_TIMER_MASKED   0x10000
+#define LAPIC_TIMER_PERIODIC     0x20000
+#define LAPIC_TIMER_MASKED       0x10000
+#define LAPIC_TIMER_TSC_DEADLINE 0x40000
+
+#define TIMER_CALIBRATE_MS     10  // PIT channel 2: at most 55 ms
+#define TIMER_CALIBRATE_REF_MS 50  // HPET / PM timer
+
+u64 lapic_timer_hz;
+u64 tsc_khz;
+int lapic_tsc_deadline;
 
 void lapic_timer_init(u8 vector, u32 initial_count) {
     lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
@@ -213,3 +292,91 @@ void lapic_timer_stop(void) {
     lapic_write(LAPIC_TIMER, LAPIC_TIMER_MASKED);
     lapic_write(LAPIC_TIMER_INIT, 0);
 }
+
+// Count a 10 ms one-shot down on PIT channel 2; returns the TSC cycles taken
+static u64 pit_calibrate_delay(void) {
+    // Load the count with the gate low and the speaker off: in mode 0 the
+    // gate only pauses counting, an edge does not reload the count
+    u16 count = PIT_FREQ * TIMER_CALIBRATE_MS / 1000;
+    u8 gate = inb(PIT_CH2_GATE) & ~0x03;
+    outb(PIT_CH2_GATE, gate);
+    outb(PIT_CMD, PIT_CMD_CH2_ONESHOT);
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, (count >> 8) & 0xFF);
+
+    // Raising the gate starts the count down; OUT2 goes high at zero
+    outb(PIT_CH2_GATE, gate | 0x01);
+    u64 tsc0 = rdtsc();
+    while (!(inb(PIT_CH2_GATE) & 0x20))
+        ;
+    u64 tsc1 = rdtsc();
+    outb(PIT_CH2_GATE, gate);
+    return tsc1 - tsc0;
+}
+
+// Against the HPET or PM timer when there is one: the window is longer and
+// its length is read exactly rather than assumed
+void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_TIMER, LAPIC_TIMER_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+
+    u64 tsc_cycles;
+    u64 ns = clock_ref_delay(TIMER_CALIBRATE_REF_MS, &tsc_cycles);
+    if (!ns) {
+        lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+        tsc_cycles = pit_calibrate_delay();
+        ns = TIMER_CALIBRATE_MS * 1000000UL;
+    }
+    u32 elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_timer_hz = (u64)elapsed * 1000000000UL / ns;
+    tsc_khz        = tsc_cycles * 1000000UL / ns;
+
+    // CPUID.1:ECX[24] = TSC-deadline timer
+    u32 a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    lapic_tsc_deadline = (c >> 24) & 1;
+
+    klog_ok("TIMER", "LAPIC %u kHz, TSC %u MHz, %s",
+            lapic_timer_hz / 1000, tsc_khz / 1000,
+            lapic_tsc_deadline ? "tsc-deadline" : "one-shot");
+}
+
+u64 tsc_to_ns(u64 tsc) {
+    if (!tsc_khz) return 0;
+    // split to keep tsc * 10^6 from overflowing on long uptimes
+    return tsc / tsc_khz * 1000000 + tsc % tsc_khz * 1000000 / tsc_khz;
+}
+
+void lapic_timer_setup(u8 vector) {
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_TIMER, vector | (lapic_tsc_deadline ? LAPIC_TIMER_TSC_DEADLINE : 0));
+    lapic_timer_disarm();
+}
+
+void lapic_timer_arm(u64 ns) {
+    if (lapic_tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, rdtsc() + ns * tsc_khz / 1000000);
+        return;
+    }
+    u64 count = ns * lapic_timer_hz / 1000000000;
+    if (count == 0) count = 1;
+    if (count > 0xFFFFFFFF) count = 0xFFFFFFFF;
+    lapic_write(LAPIC_TIMER_INIT, (u32)count);
+}
+
+void lapic_timer_disarm(void) {
+    if (lapic_tsc_deadline)
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    else
+        lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+void lapic_send_ipi(u8 apic_id, u8 vector) {
+    lapic_write(LAPIC_ICR_HI, (u32)apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, vector);
+    while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+        pause();
+}
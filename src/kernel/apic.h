@@ -27,6 +27,9 @@
 #define LAPIC_TIMER_DIV_64   0x9
 #define LAPIC_TIMER_DIV_128  0xA
 
+// ICR delivery status (send pending)
+#define LAPIC_ICR_PENDING    (1 << 12)
+
 // I/O APIC registers
 #define IOAPIC_REGSEL 0x00
 #define IOAPIC_REGWIN 0x10
@@ -57,6 +60,8 @@ void lapic_init_ap(void);
 void ioapic_init(void);
 void lapic_eoi(void);
 u32 lapic_id(void);
+// Fill in this CPU's topology fields in struct cpu from CPUID (every CPU)
+void cpu_topology_detect(void);
 void ioapic_route_irq(u8 irq, u8 vector, u8 dest_lapic_id);
 void ioapic_mask_irq(u8 irq);
 void ioapic_unmask_irq(u8 irq);
@@ -68,3 +73,21 @@ void pit_stop(void);
 void lapic_timer_init(u8 vector, u32 initial_count);
 void lapic_timer_periodic(u8 vector, u32 initial_count);
 void lapic_timer_stop(void);
+
+// Measure the LAPIC timer and TSC against the HPET or PM timer, else PIT
+// channel 2 (BSP, once, after clock_probe)
+void lapic_timer_calibrate(void);
+// Put this CPU's timer in TSC-deadline (if supported) or one-shot mode, disarmed
+void lapic_timer_setup(u8 vector);
+// Fire the timer once, ns from now / cancel it
+void lapic_timer_arm(u64 ns);
+void lapic_timer_disarm(void);
+
+extern u64 lapic_timer_hz;      // LAPIC timer counts per second at divide-by-16
+extern u64 tsc_khz;             // TSC frequency
+extern int lapic_tsc_deadline;  // timer runs in TSC-deadline mode
+
+// TSC cycles -> nanoseconds (after lapic_timer_calibrate)
+u64 tsc_to_ns(u64 tsc);
+// Fixed-delivery IPI to one CPU
+void lapic_send_ipi(u8 apic_id, u8 vector);
@@ -1,11 +1,29 @@
 #include "blk.h"
+#include "apic.h"
+#include "clock.h"
 #include "print.h"
+#include "proc.h"
+#include "sched.h"
 #include "x86.h"
 #include "vfs.h"
 
 static struct blk_device blk_devices[BLK_MAX_DEVICES];
 static u32 blk_device_count = 0;
 
+/* The timer is per device, not per request: a callback that lost the race
+   with completion finds the next request (if any) not yet due. */
+static void blk_timeout(struct timer_list *t) {
+    struct blk_device *dev = timer_entry(t, struct blk_device, timeout);
+    acquire(&dev->lock);
+    volatile struct blk_request *req = dev->current_req;
+    if (req && !req->done && clock_monotonic_ns() >= dev->deadline) {
+        req->status = BLK_ERR_TIMEOUT;
+        req->done   = 1;
+        wakeup((void *)req);
+    }
+    release(&dev->lock);
+}
+
 struct blk_device *blk_register(const char *name, struct blk_ops ops,
                                   u32 sector_size, void *priv) {
     if (blk_device_count >= BLK_MAX_DEVICES) {
@@ -19,7 +37,10 @@ struct blk_device *blk_register(const char *name, struct blk_ops ops,
     dev->ops         = ops;
     dev->sector_size = sector_size;
     dev->priv        = priv;
+    dev->busy        = 0;
     dev->current_req = 0;
+    init_timer(&dev->timeout, blk_timeout);
+    initlock(&dev->lock, "blk");
     return dev;
 }
 
@@ -49,25 +70,54 @@ int blk_submit_sync(struct blk_device *dev, u64 lba, u32 count,
         .status = 0,
     };
 
-    dev->current_req = &req;
-
-    if (dev->ops.submit(dev, &req) != 0) {
-        dev->current_req = 0;
-        return -1;
+    u64 start = tsc_to_ns(rdtsc());
+    acquire(&dev->lock);
+    while (dev->busy) {
+        if (current_proc) sleep(dev, &dev->lock);
+        else { release(&dev->lock); pause(); acquire(&dev->lock); }
     }
+    dev->busy = 1;
+    dev->current_req = &req;
+    dev->deadline = clock_monotonic_ns() + BLK_TIMEOUT_NS;
+    release(&dev->lock);
+    if (dev->ops.abort) mod_timer(&dev->timeout, dev->deadline);
 
-    // Wait for completion (works for both interrupt-driven and polling drivers)
-    while (!req.done)
-        hlt();
+    /* not under dev->lock: polling drivers complete inside submit() */
+    int err = dev->ops.submit(dev, &req);
 
+    acquire(&dev->lock);
+    if (!err) {
+        // Wait for completion (works for both interrupt-driven and polling drivers).
+        // Processes sleep on the request; before the first one exists we halt.
+        while (!req.done) {
+            if (current_proc) sleep(&req, &dev->lock);
+            else { release(&dev->lock); hlt(); acquire(&dev->lock); }
+        }
+    }
     dev->current_req = 0;
-    return req.status;
+    release(&dev->lock);
+    del_timer(&dev->timeout);
+    if (req.status == BLK_ERR_TIMEOUT) {
+        klog_fail("BLK", "%s: request at lba %u timed out", dev->name, lba);
+        dev->ops.abort(dev);
+    }
+
+    acquire(&dev->lock);
+    dev->busy = 0;
+    wakeup_one(dev);
+    release(&dev->lock);
+    /* queueing for the device counts too */
+    if (current_proc) current_proc->ru.blkio_ns += tsc_to_ns(rdtsc()) - start;
+    return err ? -1 : req.status;
 }
 
 void blk_complete(struct blk_device *dev, i32 status) {
+    acquire(&dev->lock);
     volatile struct blk_request *req = dev->current_req;
-    if (!req) return;  // spurious
-
-    req->status = status;
-    req->done   = 1;
+    if (req) {  // else spurious
+        req->status = status;
+        req->done   = 1;
+        wakeup((void *)req);
+    }
+    release(&dev->lock);
 }
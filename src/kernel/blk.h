@@ -1,8 +1,14 @@
 #pragma once
 #include "types.h"
+#include "spinlock.h"
+#include "timer.h"
 
 #define BLK_MAX_DEVICES  8
 #define BLK_NAME_LEN     16
+#define BLK_TIMEOUT_NS   (30 * NSEC_PER_SEC)
+
+// Request status besides 0 and a driver's -1
+#define BLK_ERR_TIMEOUT  (-2)
 
 struct blk_request {
     u64  lba;
@@ -17,6 +23,10 @@ struct blk_device;
 
 struct blk_ops {
     int (*submit)(struct blk_device *dev, struct blk_request *req);
+    // Stop the request in flight so nothing more is read into or written
+    // from its buffer (process context).  Requests only time out on
+    // devices that have it.
+    void (*abort)(struct blk_device *dev);
 };
 
 struct blk_device {
@@ -25,7 +35,11 @@ struct blk_device {
     struct blk_ops ops;
     void *priv;
 
+    struct spinlock lock;   // guards current_req, busy and req->done
+    int  busy;              // a request is in flight (queue depth 1)
     volatile struct blk_request *current_req;
+    struct timer_list timeout;
+    u64  deadline;          // monotonic ns current_req times out at
 };
 
 struct blk_device *blk_register(const char *name, struct blk_ops ops,
@@ -0,0 +1,196 @@
+#include "clock.h"
+#include "acpi.h"
+#include "apic.h"
+#include "mem.h"
+#include "print.h"
+#include "proc.h"
+#include "rtc.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "vdso.h"
+#include "x86.h"
+
+#define CPUID_80000007_EDX_INVARIANT_TSC (1U << 8)
+#define FS_PER_SEC 1000000000000000UL
+
+/* ---- clocksources ---- */
+
+static volatile u64 *hpet_base;
+static u16 pm_port;
+
+static inline u64 hpet_reg(u32 reg) { return hpet_base[reg / 8]; }
+static inline void hpet_set(u32 reg, u64 val) { hpet_base[reg / 8] = val; }
+
+static u64 tsc_read(void)  { return rdtsc(); }
+static u64 hpet_read(void) { return hpet_reg(HPET_MAIN_COUNTER); }
+static u64 pm_read(void)   { return inl(pm_port); }
+
+static struct clocksource cs_tsc  = { "tsc",     tsc_read,  ~0UL, 0, 0 };
+static struct clocksource cs_hpet = { "hpet",    hpet_read, 0,    0, 0 };
+static struct clocksource cs_pm   = { "acpi_pm", pm_read,   0,    PM_TIMER_HZ, 0 };
+
+/* The selected source.  One that never wraps is read lock-free against a
+   fixed base; a narrower one is extended to 64 bits in cycle_ext under
+   clock_lock, which needs a read at least once per wrap (4.7 s for a
+   24-bit PM timer): wrap_timer makes one every wrap_guard_ns. */
+static struct clocksource *clock;
+static struct spinlock clock_lock;
+static u64 cycle_last;          // counter value at ns_base (+ cycle_ext)
+static u64 cycle_ext;           // cycles since then, for wrapping sources
+static u64 ns_base;             // monotonic ns when selected
+static u64 mult;                // ns per cycle, 32.32 fixed point
+static u64 realtime_offset;     // realtime - monotonic
+static u64 wrap_guard_ns;
+static struct timer_list wrap_timer;
+
+static inline u64 mul_shr32(u64 a, u64 b)
+{
+    return (u64)(((unsigned __int128)a * b) >> 32);
+}
+
+void clock_probe(void)
+{
+    initlock(&clock_lock, "clock");
+
+    struct HPET *h = acpi_tables.hpet;
+    if (h && h->address.AddressSpace == ACPI_SPACE_MEMORY && h->address.Address) {
+        map_mmio(h->address.Address, PAGE_SIZE);
+        hpet_base = PHYS_TO_VIRT(h->address.Address);
+        u64 cap = hpet_reg(HPET_GCAP_ID);
+        u64 period = cap >> 32;     // femtoseconds per count
+        if (period && period <= HPET_PERIOD_MAX_FS) {
+            cs_hpet.freq   = FS_PER_SEC / period;
+            cs_hpet.mask   = (cap & HPET_CAP_COUNT_64) ? ~0UL : 0xFFFFFFFFUL;
+            cs_hpet.rating = CLOCK_RATING_HPET;
+            hpet_set(HPET_GEN_CONF, hpet_reg(HPET_GEN_CONF) | HPET_CONF_ENABLE);
+        }
+    }
+
+    struct FADT *f = acpi_tables.fadt;
+    if (f) {
+        u64 port = f->PMTimerBlock;
+        if (f->h.length >= FADT_X_PM_TMR_END && f->X_PMTimerBlock.Address &&
+            f->X_PMTimerBlock.AddressSpace == ACPI_SPACE_IO)
+            port = f->X_PMTimerBlock.Address;
+        if (port && port <= 0xFFFF) {
+            pm_port       = (u16)port;
+            cs_pm.mask    = (f->flags & FADT_TMR_VAL_EXT) ? 0xFFFFFFFFUL : 0xFFFFFFUL;
+            cs_pm.rating  = CLOCK_RATING_ACPI_PM;
+        }
+    }
+
+    u32 max_ext, edx = 0;
+    cpuid(0x80000000, 0, &max_ext, 0, 0, 0);
+    if (max_ext >= 0x80000007) cpuid(0x80000007, 0, 0, 0, 0, &edx);
+    cs_tsc.rating = (edx & CPUID_80000007_EDX_INVARIANT_TSC)
+                  ? CLOCK_RATING_TSC : CLOCK_RATING_TSC_UNSTABLE;
+
+    klog_ok("CLOCK", "hpet %s, acpi_pm %s, tsc %s",
+            cs_hpet.rating ? "found" : "none",
+            cs_pm.rating ? (cs_pm.mask >> 24 ? "32-bit" : "24-bit") : "none",
+            cs_tsc.rating == CLOCK_RATING_TSC ? "invariant" : "variable");
+}
+
+/* The TSC is read right after the reference at both ends, so the latency
+   of the reference read (about 1 us for the PM timer port) cancels. */
+u64 clock_ref_delay(u32 ms, u64 *tsc_cycles)
+{
+    struct clocksource *ref = cs_hpet.rating ? &cs_hpet
+                            : cs_pm.rating   ? &cs_pm : 0;
+    if (!ref) return 0;
+    u64 target = ref->freq * ms / 1000;
+    u64 start = ref->read();
+    u64 tsc0  = rdtsc();
+    u64 elapsed, tsc1;
+    do {
+        pause();
+        elapsed = (ref->read() - start) & ref->mask;
+        tsc1 = rdtsc();
+    } while (elapsed < target);
+    *tsc_cycles = tsc1 - tsc0;
+    return elapsed * NSEC_PER_SEC / ref->freq;
+}
+
+/* On CPU 0, which is never isolated; the wheel's slack is at most an
+   eighth of the period, well inside the other half of the wrap. */
+static void wrap_guard(struct timer_list *t)
+{
+    mod_timer(t, clock_monotonic_ns() + wrap_guard_ns);
+}
+
+void clock_select(void)
+{
+    struct clocksource *best = &cs_tsc;
+    cs_tsc.freq = tsc_khz * 1000;
+    if (cs_hpet.rating > best->rating) best = &cs_hpet;
+    if (cs_pm.rating > best->rating)   best = &cs_pm;
+
+    u64 real = rtc_read_epoch() * NSEC_PER_SEC;
+    /* continue from the TSC timestamps taken so far */
+    cycle_last = best->read();
+    ns_base    = tsc_to_ns(rdtsc());
+    mult       = (NSEC_PER_SEC << 32) / best->freq;
+    realtime_offset = real - ns_base;
+    clock = best;
+    if (best->mask != ~0UL) {
+        wrap_guard_ns = (best->mask + 1) * NSEC_PER_SEC / best->freq / 2;
+        init_timer(&wrap_timer, wrap_guard);
+        wrap_guard(&wrap_timer);
+    }
+
+    if (best == &cs_tsc)
+        vdso_clock_update(cycle_last, mult, ns_base, ns_base + realtime_offset);
+    klog_ok("CLOCK", "using %s (%u kHz), vDSO clocks %s",
+            best->name, best->freq / 1000,
+            best == &cs_tsc ? "enabled" : "off: reads take a syscall");
+}
+
+u64 clock_monotonic_ns(void)
+{
+    struct clocksource *cs = clock;
+    if (!cs) return tsc_to_ns(rdtsc());
+    if (cs->mask == ~0UL)
+        return ns_base + mul_shr32(cs->read() - cycle_last, mult);
+    acquire(&clock_lock);
+    u64 now = cs->read();
+    cycle_ext += (now - cycle_last) & cs->mask;
+    cycle_last = now;
+    u64 ns = ns_base + mul_shr32(cycle_ext, mult);
+    release(&clock_lock);
+    return ns;
+}
+
+u64 clock_realtime_ns(void)
+{
+    return clock_monotonic_ns() + realtime_offset;
+}
+
+i32 clock_read(u32 clk, u64 *ns)
+{
+    struct rusage ru;
+    switch (clk) {
+    case CLOCK_REALTIME:
+        *ns = clock_realtime_ns();
+        return 0;
+    case CLOCK_MONOTONIC:
+        *ns = clock_monotonic_ns();
+        return 0;
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+        if (proc_getrusage(clk == CLOCK_THREAD_CPUTIME_ID ? RUSAGE_THREAD : RUSAGE_SELF,
+                           &ru) != 0)
+            return -1;
+        *ns = ru.utime_ns + ru.stime_ns;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* ---- sleeping ---- */
+
+void clock_nanosleep(u64 ns)
+{
+    if (ns) hrtimer_sleep_until(clock_monotonic_ns() + ns);
+}
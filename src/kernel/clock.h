@@ -0,0 +1,65 @@
+#pragma once
+#include "types.h"
+
+/* Timekeeping: a clocksource (TSC, HPET or ACPI PM timer, the best one
+   the machine has) behind the monotonic and realtime clocks.  Deadlines
+   on them are timer.c's business. */
+
+#define NSEC_PER_SEC 1000000000UL
+
+#define CLOCK_REALTIME           0
+#define CLOCK_MONOTONIC          1
+#define CLOCK_PROCESS_CPUTIME_ID 2  // user + system time of the process
+#define CLOCK_THREAD_CPUTIME_ID  3  // ... of the calling thread
+
+// HPET registers (offsets from its MMIO base)
+#define HPET_GCAP_ID      0x000
+#define HPET_GEN_CONF     0x010
+#define HPET_MAIN_COUNTER 0x0F0
+
+#define HPET_CAP_COUNT_64  (1UL << 13)  // main counter is 64 bits wide
+#define HPET_CONF_ENABLE   (1UL << 0)
+#define HPET_PERIOD_MAX_FS 100000000UL  // spec limit: 10 MHz minimum
+
+#define PM_TIMER_HZ 3579545
+
+// Clocksource ratings: the highest available one is used
+#define CLOCK_RATING_TSC       300  // invariant TSC: cheapest and finest
+#define CLOCK_RATING_HPET      250
+#define CLOCK_RATING_ACPI_PM   200
+#define CLOCK_RATING_TSC_UNSTABLE 50 // TSC may change rate with P-states
+
+struct timespec {
+    i64 tv_sec;
+    i64 tv_nsec;
+};
+
+/* A free-running counter.  ns = ns_base + (count - cycle_last) * mult >> 32,
+   with the difference taken modulo mask + 1. */
+struct clocksource {
+    const char *name;
+    u64 (*read)(void);
+    u64 mask;
+    u64 freq;               // counts per second
+    int rating;             // CLOCK_RATING_*, 0 if absent
+};
+
+// Find the HPET and PM timer (BSP, after init_acpi and before
+// lapic_timer_calibrate, which measures against them)
+void clock_probe(void);
+// Spin for about ms on the best reference timer; returns the exact time
+// that passed in ns and the TSC cycles over it, or 0 if there is no
+// reference (calibrate against the PIT instead)
+u64 clock_ref_delay(u32 ms, u64 *tsc_cycles);
+// Choose the clocksource and set the wall clock from the RTC (BSP,
+// after lapic_timer_calibrate, vdso_init and timer_init)
+void clock_select(void);
+
+// Nanoseconds since boot / since 1970-01-01 UTC
+u64 clock_monotonic_ns(void);
+u64 clock_realtime_ns(void);
+// Any CLOCK_* clock for the current process; 0 or -1
+i32 clock_read(u32 clk, u64 *ns);
+
+// Block the current process for ns without holding the CPU
+void clock_nanosleep(u64 ns);
@@ -0,0 +1,51 @@
+#pragma once
+#include "types.h"
+#include "spinlock.h"
+
+/* Set of CPUs, one bit per cpu_id */
+#define CPUMASK_WORDS ((MAX_CPUS + 63) / 64)
+
+typedef struct {
+    u64 bits[CPUMASK_WORDS];
+} cpumask_t;
+
+static inline void cpumask_clear(cpumask_t *m)
+{
+    for (int i = 0; i < CPUMASK_WORDS; i++) m->bits[i] = 0;
+}
+
+static inline void cpumask_set(cpumask_t *m, u32 cpu)
+{
+    m->bits[cpu / 64] |= 1UL << (cpu % 64);
+}
+
+static inline void cpumask_unset(cpumask_t *m, u32 cpu)
+{
+    m->bits[cpu / 64] &= ~(1UL << (cpu % 64));
+}
+
+static inline int cpumask_test(const cpumask_t *m, u32 cpu)
+{
+    return cpu < MAX_CPUS && (m->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+// Every possible CPU, including ones not (yet) online
+static inline void cpumask_setall(cpumask_t *m)
+{
+    cpumask_clear(m);
+    for (u32 i = 0; i < MAX_CPUS; i++) cpumask_set(m, i);
+}
+
+static inline void cpumask_of(cpumask_t *m, u32 cpu)
+{
+    cpumask_clear(m);
+    cpumask_set(m, cpu);
+}
+
+// Nonzero if m names at least one online CPU
+static inline int cpumask_any_online(const cpumask_t *m)
+{
+    for (u32 i = 0; i < ncpu; i++)
+        if (cpumask_test(m, i)) return 1;
+    return 0;
+}
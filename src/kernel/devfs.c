@@ -206,6 +206,19 @@ static const struct vfs_file_ops devfs_dir_fops = {
     .readdir = devfs_readdir,
 };
 
+/* ---- generated text files ---- */
+
+i64 devfs_read_text(const char *text, u64 len, void *buf, u64 count,
+                    vfs_off_t *off)
+{
+    if ((u64)*off >= len) return 0;
+    u64 avail = len - (u64)*off;
+    if (avail > count) avail = count;
+    memcpy(buf, text + *off, avail);
+    *off += (vfs_off_t)avail;
+    return (i64)avail;
+}
+
 /* ---- built-in: null ---- */
 
 static i64 null_read(struct vfs_file *f, void *buf, u64 count, vfs_off_t *off)
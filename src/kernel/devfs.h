@@ -21,6 +21,11 @@ i32 devfs_register_blk(struct blk_device *dev);
    Call after kconsole_init() and devfs_init(). */
 void devfs_register_fb(void);
 
+/* Serve a read of a generated text file: copy text[*off..len) into buf,
+   advance *off and return the byte count (0 at EOF). */
+i64 devfs_read_text(const char *text, u64 len, void *buf, u64 count,
+                    vfs_off_t *off);
+
 /* Register the devfs filesystem type with the VFS and add built-in devices
    (null, zero, cons). Call after vfs_init(). */
 void devfs_init(void);
@@ -3,6 +3,7 @@
 #include "mem.h"
 #include "string.h"
 #include "print.h"
+#include "sched.h"
 
 /* ---- per-filesystem private state ---- */
 
@@ -190,6 +191,7 @@ static i32 ext2_lookup(struct vfs_inode *dir, struct vfs_dentry *child)
         u32 off_blk = offset % priv->block_size;
 
         if (lbn != cur_blk) {
+            cond_resched();     /* big directories: a block at a time */
             u32 phys = ext2_block_map(priv, dei, lbn);
             if (!phys) break;
             if (ext2_read_block(priv, phys, buf) != 0) break;
@@ -261,6 +263,7 @@ static i64 ext2_read(struct vfs_file *file, void *buf, u64 count, vfs_off_t *off
         if (chunk > count - done) chunk = count - done;
 
         if (lbn != cur_blk) {
+            cond_resched();
             u32 phys = ext2_block_map(priv, ei, lbn);
             if (!phys) break;
             if (ext2_read_block(priv, phys, blk_buf) != 0) break;
@@ -296,6 +299,7 @@ static i32 ext2_readdir(struct vfs_file *file, struct vfs_dirent *out)
         u32 blk_off = offset % priv->block_size;
 
         if (lbn != cur_blk) {
+            cond_resched();
             u32 phys = ext2_block_map(priv, ei, lbn);
             if (!phys) break;
             if (ext2_read_block(priv, phys, buf) != 0) break;
@@ -0,0 +1,199 @@
+#include "fpu.h"
+#include "mem.h"
+#include "panic.h"
+#include "print.h"
+#include "proc.h"
+#include "slab.h"
+#include "x86.h"
+
+#define CPUID_1_ECX_XSAVE (1U << 26)
+#define CPUID_1_ECX_AVX   (1U << 28)
+#define CPUID_D1_EAX_XSAVEOPT (1U << 0)
+
+// Legacy (FXSAVE) region offsets; the XSAVE header follows at 512
+#define FXSAVE_FCW    0
+#define FXSAVE_MXCSR  24
+#define FXSAVE_SIZE   512
+
+#define FCW_INIT   0x037F   // all x87 exceptions masked, 64-bit precision
+#define MXCSR_INIT 0x1F80   // all SSE exceptions masked, round to nearest
+
+#define FPU_FXSAVE   0
+#define FPU_XSAVE    1
+#define FPU_XSAVEOPT 2      // XSAVE that skips unmodified components
+
+static const char *const mode_names[] = { "fxsave", "xsave", "xsaveopt" };
+
+static int fpu_mode;
+static u64 fpu_xcr0;
+static u32 fpu_size;        // save area bytes (0 until the BSP ran fpu_init)
+static u8 *fpu_initial;     // image of the reset state new threads start from
+static struct kmem_cache fpu_cache;
+
+/* Areas are 64-byte aligned: the cache rounds sizes that are multiples of
+   64 no further and carves objects from page-aligned slabs. */
+static void fpu_save(u8 *area)
+{
+    switch (fpu_mode) {
+    case FPU_XSAVEOPT:
+        asm volatile("xsaveopt64 (%0)" : : "r"(area), "a"(~0U), "d"(~0U) : "memory");
+        break;
+    case FPU_XSAVE:
+        asm volatile("xsave64 (%0)" : : "r"(area), "a"(~0U), "d"(~0U) : "memory");
+        break;
+    default:
+        asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static void fpu_restore(const u8 *area)
+{
+    if (fpu_mode == FPU_FXSAVE)
+        asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    else
+        asm volatile("xrstor64 (%0)" : : "r"(area), "a"(~0U), "d"(~0U) : "memory");
+}
+
+static void set_ts(void)
+{
+    lcr0(rcr0() | CR0_TS);
+}
+
+void fpu_init(void)
+{
+    u32 ecx;
+    cpuid(1, 0, 0, 0, &ecx, 0);
+    int first = fpu_size == 0;
+
+    lcr0((rcr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+    u64 cr4 = rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (ecx & CPUID_1_ECX_XSAVE) cr4 |= CR4_OSXSAVE;
+    lcr4(cr4);
+
+    if (first) {
+        fpu_mode = FPU_FXSAVE;
+        fpu_size = FXSAVE_SIZE;
+        if (ecx & CPUID_1_ECX_XSAVE) {
+            u32 supported;
+            cpuid(0xD, 0, &supported, 0, 0, 0);
+            fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+            if ((ecx & CPUID_1_ECX_AVX) && (supported & XCR0_AVX))
+                fpu_xcr0 |= XCR0_AVX;
+            fpu_mode = FPU_XSAVE;
+        }
+    }
+    if (fpu_mode != FPU_FXSAVE) xsetbv(0, fpu_xcr0);
+    mycpu()->fpu_live = 0;
+    if (!first) return;
+
+    if (fpu_mode != FPU_FXSAVE) {
+        u32 size, eax;
+        cpuid(0xD, 0, 0, &size, 0, 0);      // for the features now in XCR0
+        fpu_size = (size + 63) & ~63u;
+        cpuid(0xD, 1, &eax, 0, 0, 0);
+        if (eax & CPUID_D1_EAX_XSAVEOPT) fpu_mode = FPU_XSAVEOPT;
+    }
+    kmem_cache_init(&fpu_cache, "fpu", fpu_size);
+
+    /* XSTATE_BV = 0 puts every component in its init state on XRSTOR;
+       FCW and MXCSR are loaded from the legacy region either way */
+    fpu_initial = kmem_cache_alloc(&fpu_cache);
+    if (!fpu_initial) panic("fpu_init: out of memory");
+    *(u16 *)(fpu_initial + FXSAVE_FCW)   = FCW_INIT;
+    *(u32 *)(fpu_initial + FXSAVE_MXCSR) = MXCSR_INIT;
+
+    klog_ok("FPU", "%s, %u-byte state, xcr0 %x",
+            mode_names[fpu_mode], (u64)fpu_size, fpu_xcr0);
+}
+
+/* The registers still hold p's state if p was the last to load them on
+   this CPU and has not loaded them anywhere else since. */
+static int fpu_regs_hold(struct cpu *c, struct proc *p)
+{
+    return c->fpu_owner == p && p->fpu_cpu == (u32)c->cpu_id + 1;
+}
+
+static void fpu_load(struct cpu *c, struct proc *p)
+{
+    clts();
+    c->fpu_live = 1;
+    if (fpu_regs_hold(c, p)) return;
+    fpu_restore(p->fpu_area);
+    c->fpu_owner = p;
+    p->fpu_cpu   = c->cpu_id + 1;
+}
+
+void fpu_trap(void)
+{
+    struct cpu *c = mycpu();
+    struct proc *p = c->proc;
+    if (!p->fpu_area) {
+        p->fpu_area = kmem_cache_alloc(&fpu_cache);
+        if (!p->fpu_area) {
+            /* we can't schedule from here: exception_handler exits us */
+            printf("proc %u: no memory for FPU state\r\n", (u64)p->pid);
+            p->flags |= PF_KILLED;
+            return;
+        }
+        memcpy(p->fpu_area, fpu_initial, fpu_size);
+    }
+    fpu_load(c, p);
+}
+
+void fpu_switch_in(struct proc *p)
+{
+    if (!p->fpu_area) return;
+    struct cpu *c = mycpu();
+    /* free when nothing else ran here; otherwise only for steady users */
+    if (fpu_regs_hold(c, p) || p->fpu_used >= FPU_EAGER_SLICES)
+        fpu_load(c, p);
+}
+
+/* fpu_used counts slices in a row that ended with the state loaded.  It is
+   a u8: wrapping to 0 puts an eager thread back on the lazy path now and
+   then, so one that stopped using the FPU stops paying for the restore. */
+void fpu_switch_out(struct proc *p)
+{
+    struct cpu *c = mycpu();
+    if (!c->fpu_live) {
+        p->fpu_used = 0;
+        return;
+    }
+    c->fpu_live = 0;
+    if (p->state == PROC_ZOMBIE || p->state == PROC_DEAD)
+        c->fpu_owner = 0;       /* its area is about to be freed */
+    else {
+        fpu_save(p->fpu_area);  /* it may run on another CPU next */
+        p->fpu_used++;
+    }
+    set_ts();
+}
+
+int fpu_fork(struct proc *child, struct proc *parent)
+{
+    if (!parent->fpu_area) return 0;
+    if (mycpu()->fpu_live) fpu_save(parent->fpu_area);
+    child->fpu_area = kmem_cache_alloc(&fpu_cache);
+    if (!child->fpu_area) return -1;
+    memcpy(child->fpu_area, parent->fpu_area, fpu_size);
+    return 0;
+}
+
+void fpu_release(struct proc *p)
+{
+    struct cpu *c = mycpu();
+    if (c->fpu_live) {
+        c->fpu_live = 0;
+        set_ts();
+    }
+    if (c->fpu_owner == p) c->fpu_owner = 0;
+    fpu_free(p);
+    p->fpu_used = 0;
+}
+
+void fpu_free(struct proc *p)
+{
+    if (p->fpu_area) kmem_cache_free(&fpu_cache, p->fpu_area);
+    p->fpu_area = 0;
+    p->fpu_cpu  = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "types.h"
+
+/* x87/SSE/AVX state of user threads.  The kernel is built without SSE and
+   never touches these registers, so a thread's state is only loaded when
+   it first uses them after being switched in: CR0.TS stays set until then
+   and the #NM it raises restores the saved image.  Threads that keep using
+   the FPU slice after slice get it restored eagerly instead. */
+
+struct proc;
+
+#define CR0_MP  (1UL << 1)   // WAIT/FWAIT honour TS
+#define CR0_EM  (1UL << 2)   // x87 emulation (must be clear)
+#define CR0_TS  (1UL << 3)   // task switched: next FPU use raises #NM
+#define CR0_NE  (1UL << 5)   // native x87 error reporting
+
+#define CR4_OSFXSR     (1UL << 9)   // FXSAVE/FXRSTOR and SSE
+#define CR4_OSXMMEXCPT (1UL << 10)  // unmasked SSE exceptions raise #XM
+#define CR4_OSXSAVE    (1UL << 18)  // XSAVE and XCR0
+
+#define XCR0_X87 (1UL << 0)
+#define XCR0_SSE (1UL << 1)
+#define XCR0_AVX (1UL << 2)
+
+// Consecutive slices using the FPU after which it is restored on switch-in
+#define FPU_EAGER_SLICES 5
+
+// Enable SSE (and XSAVE/AVX where present) on the calling CPU and set
+// CR0.TS.  The BSP calls it first; it sizes the save area for everyone.
+void fpu_init(void);
+
+// #NM from user mode: load current_proc's state (allocated on first use;
+// without memory it is marked PF_KILLED for exception_handler to end)
+void fpu_trap(void);
+
+// Scheduler hooks, called with the run queue lock held around swtch
+void fpu_switch_in(struct proc *p);
+void fpu_switch_out(struct proc *p);
+
+// Give child a copy of parent's state (parent is the caller); 0 or -1
+int fpu_fork(struct proc *child, struct proc *parent);
+
+// Drop p's state (exec: the next use starts from the initial state)
+void fpu_release(struct proc *p);
+
+// Free p's save area (p is off every CPU)
+void fpu_free(struct proc *p);
@@ -0,0 +1,80 @@
+#include "futex.h"
+#include "proc.h"
+
+/* Waiters live on the sleeping thread's kernel stack and sleep on their
+   own address, so a wake never disturbs an unrelated sleeper that happens
+   to share the bucket. */
+struct futex_waiter {
+    struct mm *mm;
+    u64 uaddr;
+    struct futex_waiter *next;
+    volatile int woken;
+};
+
+#define FUTEX_HASH 64
+struct futex_bucket {
+    struct spinlock lock;
+    struct futex_waiter *head;
+};
+
+static struct futex_bucket buckets[FUTEX_HASH];
+
+void futex_init(void)
+{
+    for (int i = 0; i < FUTEX_HASH; i++) {
+        initlock(&buckets[i].lock, "futex");
+        buckets[i].head = 0;
+    }
+}
+
+static struct futex_bucket *bucket_for(struct mm *mm, u64 uaddr)
+{
+    u64 h = uaddr ^ ((u64)mm >> 6);
+    h ^= h >> 17;
+    h *= 0x9E3779B97F4A7C15UL;
+    return &buckets[h >> 58];   // top 6 bits: FUTEX_HASH == 64
+}
+
+/* The value check and the queueing happen under the bucket lock, which
+   futex_wake also takes: a waker that changed the value after our check
+   finds us queued. */
+i32 futex_wait(struct mm *mm, u64 uaddr, u32 val)
+{
+    struct futex_bucket *b = bucket_for(mm, uaddr);
+    acquire(&b->lock);
+    if (*(volatile u32 *)uaddr != val) {
+        release(&b->lock);
+        return -1;
+    }
+
+    struct futex_waiter w = { .mm = mm, .uaddr = uaddr, .next = 0, .woken = 0 };
+    struct futex_waiter **pp = &b->head;
+    while (*pp) pp = &(*pp)->next;
+    *pp = &w;
+
+    while (!w.woken)
+        sleep(&w, &b->lock);
+    release(&b->lock);
+    return 0;
+}
+
+i32 futex_wake(struct mm *mm, u64 uaddr, u32 n)
+{
+    struct futex_bucket *b = bucket_for(mm, uaddr);
+    i32 woken = 0;
+    acquire(&b->lock);
+    struct futex_waiter **pp = &b->head;
+    while (*pp && (u32)woken < n) {
+        struct futex_waiter *w = *pp;
+        if (w->mm != mm || w->uaddr != uaddr) {
+            pp = &w->next;
+            continue;
+        }
+        *pp = w->next;
+        w->woken = 1;
+        wakeup(w);
+        woken++;
+    }
+    release(&b->lock);
+    return woken;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "types.h"
+
+/* Fast user-space mutexes: threads block on a u32 in their shared address
+   space.  Waiters are keyed by (mm, address), so two processes using the
+   same virtual address never see each other's wakeups. */
+
+struct mm;
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+// Initialize the wait-queue table (call once on the BSP)
+void futex_init(void);
+
+// Sleep on uaddr (in the current address space mm) while it still holds
+// val. Returns 0 once woken, -1 if the value had already changed.
+i32 futex_wait(struct mm *mm, u64 uaddr, u32 val);
+
+// Wake up to n waiters on (mm, uaddr), oldest first. Returns how many.
+i32 futex_wake(struct mm *mm, u64 uaddr, u32 n);
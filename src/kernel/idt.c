@@ -3,12 +3,16 @@
 #include "ring.h"
 #include "x86.h"
 #include "apic.h"
+#include "clock.h"
 #include "panic.h"
 #include "ps2.h"
 #include "ahci.h"
 #include "ata.h"
 #include "proc.h"
+#include "sched.h"
 #include "kconsole.h"
+#include "fpu.h"
+#include "timer.h"
 
 static struct idt_entry idt[IDT_ENTRIES];
 static struct idt_ptr idtr;
@@ -50,12 +54,6 @@ static void draw_cursor(i32 x, i32 y, int clear) {
     }
 }
 
-void timer_handler() {
-    static u32 ticks = 0;
-    ticks++;
-    yield();
-}    
-
 // Common handler that all stubs jump to
 __attribute__((naked)) void isr_common(void) {
     asm volatile(
@@ -174,6 +172,8 @@ ISR_STUB(45)
 ISR_STUB(46)  // ATA primary
 ISR_STUB(47)  // ATA secondary
 ISR_STUB(48)  // AHCI MSI
+ISR_STUB(49)  // kick IPI
+ISR_STUB(50)  // timer IPI
 
 // Spurious interrupt handler (no EOI needed)
 __attribute__((naked)) void isr_spurious(void) {
@@ -230,13 +230,15 @@ extern void isr45(void);
 extern void isr46(void);
 extern void isr47(void);
 extern void isr48(void);
+extern void isr49(void);
+extern void isr50(void);
 
-static void (*isr_table[49])(void) = {
+static void (*isr_table[51])(void) = {
     isr0,  isr1,  isr2,  isr3,  isr4,  isr5,  isr6,  isr7,  isr8,  isr9,  isr10,
     isr11, isr12, isr13, isr14, isr15, isr16, isr17, isr18, isr19, isr20, isr21,
     isr22, isr23, isr24, isr25, isr26, isr27, isr28, isr29, isr30, isr31,
     isr32, isr33, isr34, isr35, isr36, isr37, isr38, isr39, isr40, isr41,
-    isr42, isr43, isr44, isr45, isr46, isr47, isr48};
+    isr42, isr43, isr44, isr45, isr46, isr47, isr48, isr49, isr50};
 
 void idt_set_gate(u8 num, u64 handler, u8 type) {
     idt[num].offset_1 = handler & 0xFFFF;
@@ -257,8 +259,8 @@ void init_idt(void) {
         idt_set_gate(i, 0, 0);
     }
 
-    // Set up exception handlers (0-31) and IRQ handlers (32-48)
-    for (u32 i = 0; i < 49; i++) {
+    // Set up exception handlers (0-31), IRQ handlers (32-48) and IPIs (49-50)
+    for (u32 i = 0; i < 51; i++) {
         idt_set_gate(i, (u64)isr_table[i], IDT_INTERRUPT_GATE);
     }
 
@@ -282,11 +284,32 @@ static const char scancode_table[128] = {
     '*', 0, ' '
 };
 
+static void trap_dispatch(struct trap_frame *frame);
+
+/* User/kernel time is split at the user boundary; interrupts taken in the
+   kernel are already charged as system time.  Handlers never switch tasks
+   themselves: a reschedule they ask for happens on the way out, if the
+   interrupted code had interrupts on (so it holds no spinlock; syscalls
+   run with them off and reschedule at cond_resched instead). */
 void exception_handler(struct trap_frame *frame) {
+    int from_user = frame->cs & 3;
+    if (from_user) acct_enter_kernel();
+    struct cpu *c = mycpu();
+    c->preempt_count += PREEMPT_IRQ;
+    trap_dispatch(frame);
+    c->preempt_count -= PREEMPT_IRQ;
+    /* a handler that must kill the process leaves it to us: sched()
+       refuses to run inside one */
+    if (from_user && c->proc && (c->proc->flags & PF_KILLED)) proc_exit(-1);
+    if (frame->rflags & RFLAGS_IF) cond_resched();
+    if (from_user) acct_exit_kernel();
+}
+
+static void trap_dispatch(struct trap_frame *frame) {
     switch (frame->int_no) {
     case IRQ_TIMER:
         lapic_eoi();
-	timer_handler();
+        timer_interrupt();
         break;
     case IRQ_KEYBOARD: {
         kbd_interrupt();
@@ -310,6 +333,14 @@ void exception_handler(struct trap_frame *frame) {
         ahci_irq_handler();
         lapic_eoi();
         break;
+    case IPI_KICK:
+        lapic_eoi();
+        sched_kick();
+        break;
+    case IPI_TIMER:
+        lapic_eoi();
+        timer_interrupt();
+        break;
     case 0x0:
       panic("DIVISION ERROR", frame);
     case 0x1:
@@ -325,7 +356,9 @@ void exception_handler(struct trap_frame *frame) {
     case 0x6:
         panic("INVALID OPCODE", frame);
     case 0x7:
-      panic("DEVICE NOT AVAILABLE", frame);
+        if (!(frame->cs & 3)) panic("DEVICE NOT AVAILABLE", frame);
+        fpu_trap();     /* first SSE/x87 use this slice */
+        break;
     case 0x8:
         panic("DOUBLE FAULT", frame);
     case 0x9:
@@ -26,6 +26,8 @@
 #define IRQ_ATA_PRIMARY    46
 #define IRQ_ATA_SECONDARY  47
 #define IRQ_AHCI           48
+#define IPI_KICK           49   // wake an idle / tickless CPU, or preempt its task
+#define IPI_TIMER          50   // timers were queued on this CPU from another
 
 // ISR stub macros (moved from x86.h for logical grouping)
 #define ISR_STUB(num)                           \
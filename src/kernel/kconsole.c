@@ -1,4 +1,5 @@
 #include "kconsole.h"
+#include "sched.h"
 
 // ============================================================================
 // 8×8 bitmap font (IBM PC / VGA BIOS compatible, ASCII 0x00–0x7F)
@@ -214,9 +215,12 @@ static void fb_draw_glyph(u32 col, u32 row, u8 ch) {
         fb_addr[base + x] = bg_color;
 }
 
+// May reschedule between text rows: callers move the cursor back on
+// screen first
 static void fb_scroll(void) {
     // Move all rows up by one
     for (u32 r = 1; r < fb_rows; r++) {
+        cond_resched();
         for (u32 y = 0; y < FONT_H; y++) {
             u32 dst = ((r - 1) * FONT_H + y) * fb_pitch_u32;
             u32 src =  (r      * FONT_H + y) * fb_pitch_u32;
@@ -291,7 +295,7 @@ void kconsole_putc(char c) {
     if (c == '\n') {
         cur_col = 0;
         cur_row++;
-        if (cur_row >= fb_rows) { fb_scroll(); cur_row = fb_rows - 1; }
+        if (cur_row >= fb_rows) { cur_row = fb_rows - 1; fb_scroll(); }
         return;
     }
 
@@ -308,7 +312,7 @@ void kconsole_putc(char c) {
     if (cur_col >= fb_cols) {
         cur_col = 0;
         cur_row++;
-        if (cur_row >= fb_rows) { fb_scroll(); cur_row = fb_rows - 1; }
+        if (cur_row >= fb_rows) { cur_row = fb_rows - 1; fb_scroll(); }
     }
 }
 
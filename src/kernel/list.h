@@ -0,0 +1,56 @@
+#pragma once
+#include "types.h"
+
+/* Intrusive circular doubly-linked list.  An empty head points at itself. */
+
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define list_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define list_for_each(pos, head) \
+    for (struct list_head *pos = (head)->next; pos != (head); pos = pos->next)
+
+// Safe against removal of pos inside the loop body
+#define list_for_each_safe(pos, head)                                  \
+    for (struct list_head *pos = (head)->next, *pos##_n = pos->next;   \
+         pos != (head); pos = pos##_n, pos##_n = pos->next)
+
+static inline void list_init(struct list_head *h)
+{
+    h->next = h->prev = h;
+}
+
+static inline int list_empty(const struct list_head *h)
+{
+    return h->next == h;
+}
+
+static inline void list_add_tail(struct list_head *n, struct list_head *h)
+{
+    n->prev = h->prev;
+    n->next = h;
+    h->prev->next = n;
+    h->prev = n;
+}
+
+static inline void list_del(struct list_head *n)
+{
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n->prev = n;
+}
+
+// Move all of list's entries to the end of h, leaving list empty
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *h)
+{
+    if (list_empty(list)) return;
+    list->next->prev = h->prev;
+    h->prev->next = list->next;
+    list->prev->next = h;
+    h->prev = list->prev;
+    list_init(list);
+}
@@ -2,6 +2,7 @@
 #include "apic.h"
 #include "ata.h"
 #include "blk.h"
+#include "clock.h"
 #include "kconsole.h"
 #include "gdt.h"
 #include "idt.h"
@@ -13,14 +14,19 @@
 #include "proc.h"
 #include "ps2.h"
 #include "serial.h"
+#include "string.h"
 #include "syscall.h"
+#include "timer.h"
 #include "types.h"
 #include "x86.h"
 #include "pci.h"
 #include "ahci.h"
 #include "devfs.h"
+#include "fpu.h"
 #include "ext2.h"
+#include "vdso.h"
 #include "vfs.h"
+#include "workqueue.h"
 
 /* Limine requests */
 
@@ -61,11 +67,31 @@ static volatile struct limine_rsdp_request rsdp_request = {
     .revision = 0,
 };
 
+__attribute__((used, section(".requests")))
+static volatile struct limine_executable_cmdline_request cmdline_request = {
+    .id = LIMINE_EXECUTABLE_CMDLINE_REQUEST_ID,
+    .revision = 0,
+};
+
 __attribute__((used, section(".requests_end_marker")))
 static volatile uint64_t limine_requests_end[] = LIMINE_REQUESTS_END_MARKER;
 
 static volatile u64 ap_started = 0;
 
+/* Value of key=value in the kernel command line (space separated), or 0 */
+static const char *cmdline_option(const char *key)
+{
+    struct limine_executable_cmdline_response *r = cmdline_request.response;
+    if (!r || !r->cmdline) return 0;
+    u64 klen = kstrlen(key);
+    for (const char *s = r->cmdline; *s; ) {
+        while (*s == ' ') s++;
+        if (kstreq_nlit(s, klen, key) && s[klen] == '=') return s + klen + 1;
+        while (*s && *s != ' ') s++;
+    }
+    return 0;
+}
+
 void ap_entry(struct limine_mp_info *info) {
     // Find our CPU slot
     u32 apic_id = info->lapic_id;
@@ -87,10 +113,14 @@ void ap_entry(struct limine_mp_info *info) {
     // Restore GS base after GDT reload
     wrmsr(MSR_GS_BASE, (u64)c);
     wrmsr(MSR_KERNEL_GS_BASE, (u64)c);
+    cpu_topology_detect();
     load_idt();
+    pat_init();
+    fpu_init();
     lapic_init_ap();
     init_syscall();
-    lapic_timer_periodic(32, 1000000);
+    lapic_timer_setup(IRQ_TIMER);
+    vdso_init_cpu();
 
     __sync_fetch_and_add(&ap_started, 1);
 
@@ -109,14 +139,15 @@ void _start(void) {
     init_serial();
     kconsole_init(fb_request.response->framebuffers[0]);
 
-    puts("\r\n\033[1;36m  ====  OS Kernel  ====\033[0m\r\n");
-
-    /* BSP cpu slot must be set up before any spinlock/mycpu() use */
+    /* BSP cpu slot must be set up before any spinlock/mycpu() use
+       (console output included: scrolling may cond_resched) */
     cpus[0].cpu_id = 0;
     ncpu = 1;
     wrmsr(MSR_GS_BASE, (u64)&cpus[0]);
     wrmsr(MSR_KERNEL_GS_BASE, (u64)&cpus[0]);
 
+    puts("\r\n\033[1;36m  ====  OS Kernel  ====\033[0m\r\n");
+
     klog("MEM", "initializing buddy allocator");
     kinit(hhdm_request.response->offset);
 
@@ -136,18 +167,29 @@ void _start(void) {
     init_gdt();
     wrmsr(MSR_GS_BASE, (u64)&cpus[0]);
     wrmsr(MSR_KERNEL_GS_BASE, (u64)&cpus[0]);
+    cpu_topology_detect();
     klog_ok("GDT", "segments loaded");
 
     init_syscall();
     proc_init();
     klog_ok("SYSCALL", "MSRs configured");
+    fpu_init();
 
+    pat_init();
     for (u64 i = 0; i < memmap_response->entry_count; i++) {
         struct limine_memmap_entry *entry = entries[i];
-        if (entry->type != LIMINE_MEMMAP_USABLE &&
-            entry->type != LIMINE_MEMMAP_BAD_MEMORY)
+        if (entry->type == LIMINE_MEMMAP_FRAMEBUFFER)
+            map_mmio_type(entry->base, entry->length, MEM_WC);
+        else if (entry->type != LIMINE_MEMMAP_USABLE &&
+                 entry->type != LIMINE_MEMMAP_BAD_MEMORY)
             map_mmio(entry->base, entry->length);
     }
+    {
+        /* kconsole draws pixel-by-pixel: never leave the framebuffer uncached */
+        struct limine_framebuffer *fb = fb_request.response->framebuffers[0];
+        map_mmio_type(VIRT_TO_PHYS(fb->address), fb->pitch * fb->height, MEM_WC);
+    }
+    klog_ok("PAT", "framebuffer mapped write-combining");
     u64 rsdp_phys = (u64)rsdp_request.response->address;
     map_mmio(rsdp_phys, PAGE_SIZE);
 
@@ -162,7 +204,12 @@ void _start(void) {
 
     ioapic_route_irq(0,  32, lapic_id());
     pit_stop();
-    lapic_timer_periodic(32, 1000000);
+    clock_probe();
+    lapic_timer_calibrate();
+    lapic_timer_setup(IRQ_TIMER);
+    vdso_init();
+    timer_init();
+    clock_select();
     ioapic_route_irq(1,  33, lapic_id());
     ioapic_route_irq(12, 44, lapic_id());
     ioapic_route_irq(14, 46, lapic_id());
@@ -180,6 +227,8 @@ void _start(void) {
     ext2_init();
     initfs_init();
     devfs_init();
+    sched_devfs_init();
+    proc_devfs_init();
     klog_ok("VFS", "filesystems registered");
 
     /* initfs is the permanent root — always succeeds */
@@ -237,9 +286,14 @@ void _start(void) {
         klog_ok("SMP", "%u CPU(s) online", ncpu);
     }
 
+    sched_topology_init();
+    const char *isol = cmdline_option("isolcpus");
+    if (isol) sched_isolate_cpus(isol);
+
     struct proc *p = proc_create("/bin/init");
     if (p) klog_ok("PROC", "init started (pid %u)", p->pid);
     else   klog_fail("PROC", "no init found at /bin/init");
+    workqueue_start();
 
     puts("\r\n\r\n\033[1;32m  kernel ready\033[0m\r\n\r\n");
     scheduler();
@@ -1,8 +1,11 @@
 #include "mem.h"
+#include "sched.h"
 #include "spinlock.h"
 #include "types.h"
+#include "x86.h"
 
 u64 hhdm_offset;
+static u64 kernel_cr3;  // boot page tables: kernel half only matters
 
 // ---------------------------------------------------------------------------
 // Binary buddy allocator
@@ -41,6 +44,7 @@ void *memset(void *dst, int c, u64 n) {
 
 void kinit(u64 hhdm) {
   hhdm_offset = hhdm;
+  kernel_cr3 = rcr3();
   initlock(&buddy.lock, "buddy");
   buddy.use_lock = 0;
   for (int i = 0; i < MAX_ORDER; i++)
@@ -226,15 +230,63 @@ void map_page(u64 virt, u64 phys, u64 flags) {
   asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
 }
 
-void map_mmio(u64 phys, u64 size) {
+// ---------------------------------------------------------------------------
+// Page Attribute Table
+// PA0-PA3 keep their power-on values so plain PCD/PWT encodings stay valid;
+// PA4-PA7 match what Limine programs (PA5 = WC).
+//   PA0 WB  PA1 WT  PA2 UC-  PA3 UC  PA4 WP  PA5 WC  PA6 UC-  PA7 UC
+// ---------------------------------------------------------------------------
+#define PAT_UC        0x00
+#define PAT_WC        0x01
+#define PAT_WT        0x04
+#define PAT_WP        0x05
+#define PAT_WB        0x06
+#define PAT_UC_MINUS  0x07
+
+#define PAT_ENTRY(i, t) ((u64)(t) << ((i) * 8))
+#define PAT_VALUE (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WT) | \
+                   PAT_ENTRY(2, PAT_UC_MINUS) | PAT_ENTRY(3, PAT_UC) | \
+                   PAT_ENTRY(4, PAT_WP) | PAT_ENTRY(5, PAT_WC) | \
+                   PAT_ENTRY(6, PAT_UC_MINUS) | PAT_ENTRY(7, PAT_UC))
+
+#define CPUID_1_EDX_PAT (1U << 16)
+
+static u8 pat_enabled;
+
+// Program IA32_PAT on the calling CPU. Every CPU must run this, with the same
+// value, before touching a WC mapping.
+void pat_init(void) {
+  u32 edx;
+  cpuid(1, 0, 0, 0, 0, &edx);
+  if (!(edx & CPUID_1_EDX_PAT))
+    return;
+  wrmsr(MSR_PAT, PAT_VALUE);
+  lcr3(rcr3());  // drop TLB entries cached with the old attributes
+  pat_enabled = 1;
+}
+
+// PTE bits selecting `type` (PAT index = PAT<<2 | PCD<<1 | PWT)
+u64 mem_type_flags(u32 type) {
+  switch (type) {
+  case MEM_WC:       return pat_enabled ? (PTE_PAT | PTE_PWT) : (PTE_PCD | PTE_PWT);
+  case MEM_UC_MINUS: return PTE_PCD;
+  case MEM_UC:       return PTE_PCD | PTE_PWT;
+  default:           return 0;
+  }
+}
+
+void map_mmio_type(u64 phys, u64 size, u32 type) {
   u64 start = phys & ~(PAGE_SIZE - 1);
   u64 end = (phys + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  u64 flags = PTE_PRESENT | PTE_WRITE | mem_type_flags(type);
 
-  for (u64 p = start; p < end; p += PAGE_SIZE) {
-    u64 virt = (u64)PHYS_TO_VIRT(p);
-    // MMIO: present, writable, cache-disable, write-through
-    map_page(virt, p, PTE_PRESENT | PTE_WRITE | PTE_PCD | PTE_PWT);
-  }
+  for (u64 p = start; p < end; p += PAGE_SIZE)
+    map_page((u64)PHYS_TO_VIRT(p), p, flags);
+}
+
+// Register BARs: strong uncached
+void map_mmio(u64 phys, u64 size) {
+  map_mmio_type(phys, size, MEM_UC);
 }
 
 void map_page_pml4(u64 *pml4, u64 virt, u64 phys, u64 flags) {
@@ -266,6 +318,11 @@ void map_page_pml4(u64 *pml4, u64 virt, u64 phys, u64 flags) {
   pt[PT_INDEX(virt)] = (phys & PAGE_FRAME_MASK) | flags | PTE_PRESENT;
 }
 
+// Drop any user address space from CR3 (e.g. before it is freed)
+void load_kernel_pml4(void) {
+  lcr3(kernel_cr3);
+}
+
 u64 *create_user_pml4(void) {
   u64 *new_pml4 = (u64 *)kalloc(1);
   if (!new_pml4) return 0;
@@ -280,7 +337,8 @@ u64 *create_user_pml4(void) {
 }
 
 /* Deep-copy the user-space half (entries 0-255) of old_pml4 into new_pml4.
-   new_pml4 must already have the kernel half initialised (e.g. via create_user_pml4). */
+   new_pml4 must already have the kernel half initialised (e.g. via create_user_pml4).
+   Reschedules between page tables when called without locks held. */
 void copy_user_pml4(u64 *new_pml4, u64 *old_pml4)
 {
   for (int i4 = 0; i4 < 256; i4++) {
@@ -294,6 +352,7 @@ void copy_user_pml4(u64 *new_pml4, u64 *old_pml4)
       for (int i2 = 0; i2 < 512; i2++) {
         if (!(old_pd[i2] & PTE_PRESENT)) continue;
         pte_t *old_pt = (pte_t *)PHYS_TO_VIRT(old_pd[i2] & PAGE_FRAME_MASK);
+        cond_resched();
 
         for (int i1 = 0; i1 < 512; i1++) {
           pte_t pte = old_pt[i1];
@@ -302,11 +361,16 @@ void copy_user_pml4(u64 *new_pml4, u64 *old_pml4)
           u64 va = ((u64)i4 << 39) | ((u64)i3 << 30) |
                    ((u64)i2 << 21) | ((u64)i1 << 12);
 
+          u64 flags = (pte & ~PAGE_FRAME_MASK) & ~(u64)PTE_PRESENT;
+          if (pte & PTE_SHARED) {
+            /* device or kernel-owned frame: map the same page */
+            map_page_pml4(new_pml4, va, pte & PAGE_FRAME_MASK, flags);
+            continue;
+          }
+
           void *new_page = kalloc(1);
           if (!new_page) continue;
           memcpy(new_page, PHYS_TO_VIRT(pte & PAGE_FRAME_MASK), PAGE_SIZE);
-
-          u64 flags = (pte & ~PAGE_FRAME_MASK) & ~(u64)PTE_PRESENT;
           map_page_pml4(new_pml4, va, VIRT_TO_PHYS((u64)new_page), flags);
         }
       }
@@ -315,7 +379,8 @@ void copy_user_pml4(u64 *new_pml4, u64 *old_pml4)
 }
 
 /* Free all user-space pages and intermediate page table pages in pml4
-   (entries 0-255 only; kernel half is shared and must not be freed). */
+   (entries 0-255 only; kernel half is shared and must not be freed).
+   PTE_SHARED frames belong to someone else and are left alone. */
 void free_user_pml4(u64 *pml4)
 {
   for (int i4 = 0; i4 < 256; i4++) {
@@ -332,7 +397,7 @@ void free_user_pml4(u64 *pml4)
 
         for (int i1 = 0; i1 < 512; i1++) {
           pte_t pte = pt[i1];
-          if ((pte & PTE_PRESENT) && (pte & PTE_USER))
+          if ((pte & PTE_PRESENT) && (pte & PTE_USER) && !(pte & PTE_SHARED))
             kfree(PHYS_TO_VIRT(pte & PAGE_FRAME_MASK), 1);
         }
         kfree(pt, 1);
@@ -14,8 +14,16 @@ extern u64 hhdm_offset;
 #define PTE_USER     (1UL << 2)
 #define PTE_PWT      (1UL << 3)  // Write-through
 #define PTE_PCD      (1UL << 4)  // Cache disable
+#define PTE_PAT      (1UL << 7)  // PAT index bit 2 (4 KiB PTEs only)
+#define PTE_SHARED   (1UL << 9)  // software: frame not owned by this address space
 #define PTE_NX       (1UL << 63) // No execute
 
+// Memory types, selected through PAT/PCD/PWT (see pat_init)
+#define MEM_WB        0   // write-back (normal RAM)
+#define MEM_WC        1   // write-combining (framebuffers)
+#define MEM_UC_MINUS  2   // uncached, overridable by MTRR WC
+#define MEM_UC        3   // strong uncached (register BARs, LAPIC)
+
 // Page frame mask (clear lower 12 bits)
 #define PAGE_FRAME_MASK  (~0xFFFUL)
 
@@ -42,8 +50,12 @@ void kinit(u64 hhdm);
 void map_page(u64 virt, u64 phys, u64 flags);
 void map_page_pml4(u64 *pml4, u64 virt, u64 phys, u64 flags);
 u64 *create_user_pml4(void);
+void load_kernel_pml4(void);
 void copy_user_pml4(u64 *new_pml4, u64 *old_pml4);
 void free_user_pml4(u64 *pml4);
 void map_mmio(u64 phys, u64 size);
+void map_mmio_type(u64 phys, u64 size, u32 type);
+u64  mem_type_flags(u32 type);
+void pat_init(void);
 void *memcpy(void *dst, const void *src, u64 n);
 void buddy_enable_lock(void);
@@ -1,4 +1,5 @@
 #include "pci.h"
+#include "apic.h"
 #include "print.h"
 
 struct pci_device pci_devices[MAX_PCI_DEVICES];
@@ -94,8 +95,9 @@ int pci_msi_enable(struct pci_device *dev, u8 vector) {
     u16 ctrl = pci_read16(dev->bus, dev->slot, dev->func, cap + 2);
 
     // MSI address format for x86: MSI_ADDR_BASE | (dest_apic << 12)
-    // We send to LAPIC 0, edge triggered, fixed delivery
-    u32 addr = MSI_ADDR_BASE;  // Dest APIC 0
+    // We send to the calling CPU (the BSP at boot, which is never
+    // isolated), edge triggered, fixed delivery
+    u32 addr = MSI_ADDR_BASE | (lapic_id() << 12);
 
     // Write address
     pci_write32(dev->bus, dev->slot, dev->func, cap + 4, addr);
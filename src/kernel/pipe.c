@@ -2,6 +2,7 @@
 #include "mem.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sched.h"
 
 #define PIPE_BUF 4096
 
@@ -20,28 +21,31 @@ struct pipe {
 #define PIPE_READ_END  1
 #define PIPE_WRITE_END 2
 
+/* Readers sleep on &p->read_pos waiting for data, writers on &p->write_pos
+   waiting for room; both conditions are checked and changed under p->lock. */
 static i64 pipe_read(struct vfs_file *f, void *buf, u64 len, vfs_off_t *off)
 {
     (void)off;
     struct pipe *p = (struct pipe *)f->inode->priv;
     u8 *dst = (u8 *)buf;
     u64 n = 0;
+    acquire(&p->lock);
     while (n < len) {
-        acquire(&p->lock);
         while (p->count == 0) {
             if (!p->write_open) {    /* writer closed: EOF */
                 release(&p->lock);
                 return (i64)n;
             }
-            release(&p->lock);
-            yield();
-            acquire(&p->lock);
+            sleep(&p->read_pos, &p->lock);
+        }
+        while (n < len && p->count > 0) {
+            dst[n++] = p->buf[p->read_pos % PIPE_BUF];
+            p->read_pos++;
+            p->count--;
         }
-        dst[n++] = p->buf[p->read_pos % PIPE_BUF];
-        p->read_pos++;
-        p->count--;
-        release(&p->lock);
+        wakeup(&p->write_pos);
     }
+    release(&p->lock);
     return (i64)n;
 }
 
@@ -50,22 +54,24 @@ static i64 pipe_write(struct vfs_file *f, const void *buf, u64 len, vfs_off_t *o
     (void)off;
     struct pipe *p = (struct pipe *)f->inode->priv;
     const u8 *src = (const u8 *)buf;
-    for (u64 i = 0; i < len; i++) {
-        acquire(&p->lock);
+    u64 i = 0;
+    acquire(&p->lock);
+    while (i < len) {
         while (p->count == PIPE_BUF) {
             if (!p->read_open) {     /* broken pipe */
                 release(&p->lock);
                 return -1;
             }
-            release(&p->lock);
-            yield();
-            acquire(&p->lock);
+            sleep(&p->write_pos, &p->lock);
+        }
+        while (i < len && p->count < PIPE_BUF) {
+            p->buf[p->write_pos % PIPE_BUF] = src[i++];
+            p->write_pos++;
+            p->count++;
         }
-        p->buf[p->write_pos % PIPE_BUF] = src[i];
-        p->write_pos++;
-        p->count++;
-        release(&p->lock);
+        wakeup(&p->read_pos);
     }
+    release(&p->lock);
     return (i64)len;
 }
 
@@ -78,6 +84,9 @@ static i32 pipe_close(struct vfs_file *f)
     else
         p->read_open--;
     int dead = (!p->read_open && !p->write_open);
+    /* let the other end see EOF / broken pipe */
+    wakeup(&p->read_pos);
+    wakeup(&p->write_pos);
     release(&p->lock);
     if (dead)
         kfree(p, 1);
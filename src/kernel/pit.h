@@ -6,6 +6,7 @@
 #define PIT_CH0       0x40      // Channel 0 data port
 #define PIT_CH1       0x41      // Channel 1 data port
 #define PIT_CH2       0x42      // Channel 2 data port
+#define PIT_CH2_GATE  0x61      // Port B: bit0 ch2 gate, bit1 speaker, bit5 ch2 out
 
 // PIT command byte format: CCAA_MMMB
 // CC = channel (00=0, 01=1, 10=2, 11=read-back)
@@ -35,3 +36,4 @@
 // Common combined commands
 #define PIT_CMD_CH0_SQUARE   (PIT_CH0_SELECT | PIT_ACCESS_LOHIBYTE | PIT_MODE_SQUARE)     // 0x36
 #define PIT_CMD_CH0_ONESHOT  (PIT_CH0_SELECT | PIT_ACCESS_LOHIBYTE | PIT_MODE_INTTERM)    // 0x30
+#define PIT_CMD_CH2_ONESHOT  (PIT_CH2_SELECT | PIT_ACCESS_LOHIBYTE | PIT_MODE_INTTERM)    // 0xB0
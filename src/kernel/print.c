@@ -73,9 +73,27 @@ static int strlen_(const char *s) {
     return len;
 }
 
+/* Output sink for do_vprintf: buf == 0 writes to the console, otherwise
+   into buf (truncated to cap-1 chars, always NUL-terminated). */
+struct sink {
+    char *buf;
+    u64   cap;
+    u64   len;   // chars produced (may exceed cap)
+};
+
+static void sink_putc(struct sink *o, char c) {
+    if (!o->buf) { putc(c); return; }
+    if (o->len + 1 < o->cap) o->buf[o->len] = c;
+    o->len++;
+}
+
+static void sink_puts(struct sink *o, const char *s) {
+    while (*s) sink_putc(o, *s++);
+}
+
 // Helper: print padding
-static void pad(int count, char c) {
-    while (count-- > 0) putc(c);
+static void pad(struct sink *o, int count, char c) {
+    while (count-- > 0) sink_putc(o, c);
 }
 
 // Helper: format number to buffer, return length
@@ -105,10 +123,10 @@ static int fmt_hex(char *buf, u64 n) {
     return i;
 }
 
-static void do_vprintf(const char *fmt, va_list args) {
+static void do_vprintf(struct sink *o, const char *fmt, va_list args) {
     while (*fmt) {
         if (*fmt != '%') {
-            putc(*fmt++);
+            sink_putc(o, *fmt++);
             continue;
         }
         fmt++;  // skip '%'
@@ -142,43 +160,46 @@ static void do_vprintf(const char *fmt, va_list args) {
             if (neg) n = -n;
             len = fmt_dec(buf, (u64)n);
             int total = len + neg;
-            if (!left_align && !zero_pad) pad(width - total, ' ');
-            if (neg) putc('-');
-            if (!left_align && zero_pad) pad(width - total, '0');
-            for (int i = 0; i < len; i++) putc(buf[i]);
-            if (left_align) pad(width - total, ' ');
+            if (!left_align && !zero_pad) pad(o, width - total, ' ');
+            if (neg) sink_putc(o, '-');
+            if (!left_align && zero_pad) pad(o, width - total, '0');
+            for (int i = 0; i < len; i++) sink_putc(o, buf[i]);
+            if (left_align) pad(o, width - total, ' ');
             break;
         }
         case 'u': {
             u64 n = va_arg(args, u64);
             len = fmt_dec(buf, n);
-            if (!left_align) pad(width - len, padchar);
-            for (int i = 0; i < len; i++) putc(buf[i]);
-            if (left_align) pad(width - len, ' ');
+            if (!left_align) pad(o, width - len, padchar);
+            for (int i = 0; i < len; i++) sink_putc(o, buf[i]);
+            if (left_align) pad(o, width - len, ' ');
             break;
         }
         case 'x': {
             u64 n = va_arg(args, u64);
             len = fmt_hex(buf, n);
-            if (!left_align) pad(width - len, padchar);
-            for (int i = 0; i < len; i++) putc(buf[i]);
-            if (left_align) pad(width - len, ' ');
+            if (!left_align) pad(o, width - len, padchar);
+            for (int i = 0; i < len; i++) sink_putc(o, buf[i]);
+            if (left_align) pad(o, width - len, ' ');
             break;
         }
         case 'X': {
             u64 n = va_arg(args, u64);
             len = fmt_hex(buf, n);
             int total = len + 2;
-            if (!left_align) pad(width - total, padchar);
-            puts("0x");
-            for (int i = 0; i < len; i++) putc(buf[i]);
-            if (left_align) pad(width - total, ' ');
+            if (!left_align) pad(o, width - total, padchar);
+            sink_puts(o, "0x");
+            for (int i = 0; i < len; i++) sink_putc(o, buf[i]);
+            if (left_align) pad(o, width - total, ' ');
             break;
         }
         case 'p': {
             u64 n = va_arg(args, u64);
-            puts("0x");
-            puthex64(n);
+            sink_puts(o, "0x");
+            for (int i = 15; i >= 0; i--) {
+                u8 nib = (n >> (i * 4)) & 0xF;
+                sink_putc(o, nib < 10 ? '0' + nib : 'a' + nib - 10);
+            }
             break;
         }
         case 's': {
@@ -190,27 +211,27 @@ static void do_vprintf(const char *fmt, va_list args) {
             if (center) {
                 int left_pad = padding / 2;
                 int right_pad = padding - left_pad;
-                pad(left_pad, ' ');
-                puts(s);
-                pad(right_pad, ' ');
+                pad(o, left_pad, ' ');
+                sink_puts(o, s);
+                pad(o, right_pad, ' ');
             } else {
-                if (!left_align) pad(padding, ' ');
-                puts(s);
-                if (left_align) pad(padding, ' ');
+                if (!left_align) pad(o, padding, ' ');
+                sink_puts(o, s);
+                if (left_align) pad(o, padding, ' ');
             }
             break;
         }
         case 'c':
-            if (!left_align) pad(width - 1, ' ');
-            putc((char)va_arg(args, int));
-            if (left_align) pad(width - 1, ' ');
+            if (!left_align) pad(o, width - 1, ' ');
+            sink_putc(o, (char)va_arg(args, int));
+            if (left_align) pad(o, width - 1, ' ');
             break;
         case '%':
-            putc('%');
+            sink_putc(o, '%');
             break;
         default:
-            putc('%');
-            putc(*fmt);
+            sink_putc(o, '%');
+            sink_putc(o, *fmt);
             break;
         }
         fmt++;
@@ -218,31 +239,45 @@ static void do_vprintf(const char *fmt, va_list args) {
 }
 
 void printf(const char *fmt, ...) {
+    struct sink con = { 0, 0, 0 };
+    va_list args;
+    va_start(args, fmt);
+    do_vprintf(&con, fmt, args);
+    va_end(args);
+}
+
+u64 ksnprintf(char *buf, u64 size, const char *fmt, ...) {
+    struct sink o = { buf, size, 0 };
     va_list args;
     va_start(args, fmt);
-    do_vprintf(fmt, args);
+    do_vprintf(&o, fmt, args);
     va_end(args);
+    if (size) buf[o.len < size ? o.len : size - 1] = 0;
+    return o.len < size ? o.len : (size ? size - 1 : 0);
 }
 
 /* ---- Structured kernel log ---- */
 
 void klog(const char *tag, const char *fmt, ...) {
     printf("\r\n  [ %s ] ", tag);
+    struct sink con = { 0, 0, 0 };
     va_list args; va_start(args, fmt);
-    do_vprintf(fmt, args);
+    do_vprintf(&con, fmt, args);
     va_end(args);
 }
 
 void klog_ok(const char *tag, const char *fmt, ...) {
     printf("\r\n  [ \033[32m%s\033[0m ] ", tag);
+    struct sink con = { 0, 0, 0 };
     va_list args; va_start(args, fmt);
-    do_vprintf(fmt, args);
+    do_vprintf(&con, fmt, args);
     va_end(args);
 }
 
 void klog_fail(const char *tag, const char *fmt, ...) {
     printf("\r\n  [ \033[31m%s\033[0m ] ", tag);
+    struct sink con = { 0, 0, 0 };
     va_list args; va_start(args, fmt);
-    do_vprintf(fmt, args);
+    do_vprintf(&con, fmt, args);
     va_end(args);
 }
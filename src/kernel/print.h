@@ -13,6 +13,10 @@ void puthex(u64 n);  // auto-width
 // printf-lite (supports %d, %u, %x, %s, %c, %p)
 void printf(const char *fmt, ...);
 
+// Format into buf (same conversions as printf). Always NUL-terminates when
+// size > 0; returns the number of chars stored, excluding the NUL.
+u64 ksnprintf(char *buf, u64 size, const char *fmt, ...);
+
 // Structured kernel log — always outputs "[ TAG ] msg\r\n"
 // Use klog_ok / klog_fail / klog for info, success, failure.
 void klog(const char *tag, const char *fmt, ...);
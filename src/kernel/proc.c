@@ -1,50 +1,181 @@
 #include "proc.h"
+#include "apic.h"
+#include "devfs.h"
 #include "elf.h"
+#include "fpu.h"
+#include "futex.h"
 #include "gdt.h"
 #include "idt.h"
 #include "mem.h"
 #include "panic.h"
+#include "slab.h"
 #include "vfs.h"
 #include "print.h"
 #include "syscall.h"
+#include "vdso.h"
 #include "x86.h"
 
+/* proc_lock guards the pid hash, the list of all processes, parent/child
+   links, thread counts and process state changes seen by wait(). */
 static struct spinlock proc_lock;
-struct proc proc_table[MAX_PROCS];
 static u32 next_pid = 1;
+static struct list_head all_procs;
+static u32 nr_procs;
 
-void proc_init(void)  { initlock(&proc_lock, "proc"); }
+#define PID_HASH 128
+static struct proc *pid_hash[PID_HASH];
+
+/* Orphans are handed to init, which reaps them in its wait() loop */
+static struct proc *initproc;
+
+static struct kmem_cache proc_cache;
+static struct kmem_cache mm_cache;
+static struct kmem_cache files_cache;
+
+void proc_init(void)
+{
+    initlock(&proc_lock, "proc");
+    list_init(&all_procs);
+    kmem_cache_init(&proc_cache,  "proc",  sizeof(struct proc));
+    kmem_cache_init(&mm_cache,    "mm",    sizeof(struct mm));
+    kmem_cache_init(&files_cache, "files", sizeof(struct files));
+    sched_init();
+    workqueue_init();
+    futex_init();
+}
 void acquire_proc_lock(void) { acquire(&proc_lock); }
 void release_proc_lock(void) { release(&proc_lock); }
 struct context **cpu_context_ptr(void) { return &mycpu()->scheduler_ctx; }
 
+/* ---- address spaces ---- */
+
+static struct mm *mm_alloc(void)
+{
+    struct mm *mm = kmem_cache_alloc(&mm_cache);
+    if (!mm) return 0;
+    initlock(&mm->lock, "mm");
+    mm->refcnt = 1;
+    mm->brk    = USER_HEAP_BASE;
+    mm->pml4   = create_user_pml4();
+    if (!mm->pml4) {
+        kmem_cache_free(&mm_cache, mm);
+        return 0;
+    }
+    if (vdso_map(mm) != 0) {
+        free_user_pml4(mm->pml4);
+        kfree(mm->pml4, 1);
+        kmem_cache_free(&mm_cache, mm);
+        return 0;
+    }
+    return mm;
+}
+
+static void mm_get(struct mm *mm) { __atomic_add_fetch(&mm->refcnt, 1, __ATOMIC_RELAXED); }
+
+/* Last reference: nobody can have the page table loaded any more */
+static void mm_put(struct mm *mm)
+{
+    if (__atomic_sub_fetch(&mm->refcnt, 1, __ATOMIC_ACQ_REL) != 0) return;
+    free_user_pml4(mm->pml4);
+    kfree(mm->pml4, 1);
+    vdso_unmap(mm);
+    kmem_cache_free(&mm_cache, mm);
+}
+
+/* fork: a fresh address space with a copy of src's user pages.  Page
+   tables only grow until the mm dies, so the copy walks src unlocked and
+   may reschedule.  The break is taken first: every page below it is
+   already mapped and gets copied; ones another thread maps meanwhile may
+   or may not be. */
+static struct mm *mm_dup(struct mm *src)
+{
+    struct mm *mm = mm_alloc();
+    if (!mm) return 0;
+    acquire(&src->lock);
+    mm->brk = src->brk;
+    release(&src->lock);
+    copy_user_pml4(mm->pml4, src->pml4);
+    vdso_map(mm);   /* the copy mapped src's vdso_proc page: use our own */
+    return mm;
+}
+
+/* ---- fd tables ---- */
+
+static struct files *files_alloc(void)
+{
+    struct files *fs = kmem_cache_alloc(&files_cache);
+    if (!fs) return 0;
+    initlock(&fs->lock, "files");
+    fs->refcnt = 1;
+    return fs;
+}
+
+/* fork: a private copy sharing the open files themselves */
+static struct files *files_dup(struct files *src)
+{
+    struct files *fs = files_alloc();
+    if (!fs) return 0;
+    acquire(&src->lock);
+    for (int i = 0; i < MAX_FDS; i++) {
+        if (src->fd[i]) {
+            vfs_file_get(src->fd[i]);
+            fs->fd[i] = src->fd[i];
+        }
+    }
+    release(&src->lock);
+    return fs;
+}
+
+static void files_put(struct files *fs)
+{
+    if (__atomic_sub_fetch(&fs->refcnt, 1, __ATOMIC_ACQ_REL) != 0) return;
+    for (int i = 0; i < MAX_FDS; i++) {
+        if (fs->fd[i]) {
+            vfs_close(fs->fd[i]);
+            fs->fd[i] = 0;
+        }
+    }
+    kmem_cache_free(&files_cache, fs);
+}
+
 /* ---- fd helpers ---- */
 
 i32 fd_alloc(struct proc *p, struct vfs_file *f)
 {
+    struct files *fs = p->files;
+    acquire(&fs->lock);
     for (int i = 0; i < MAX_FDS; i++) {
-        if (!p->files[i]) {
-            p->files[i] = f;
+        if (!fs->fd[i]) {
+            fs->fd[i] = f;
+            release(&fs->lock);
             return i;
         }
     }
+    release(&fs->lock);
     return -1;
 }
 
 struct vfs_file *fd_get(struct proc *p, i32 fd)
 {
     if (fd < 0 || fd >= MAX_FDS) return 0;
-    return p->files[fd];
+    return p->files->fd[fd];
+}
+
+struct vfs_file *fd_install(struct proc *p, i32 fd, struct vfs_file *f)
+{
+    struct files *fs = p->files;
+    acquire(&fs->lock);
+    struct vfs_file *old = fs->fd[fd];
+    fs->fd[fd] = f;
+    release(&fs->lock);
+    return old;
 }
 
 void proc_close_fds(struct proc *p)
 {
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (p->files[i]) {
-            vfs_close(p->files[i]);
-            p->files[i] = 0;
-        }
-    }
+    if (!p->files) return;
+    files_put(p->files);
+    p->files = 0;
 }
 
 /* Open /dev/null and /dev/cons for fds 0/1/2.  Silently ignores failures
@@ -53,42 +184,200 @@ static void proc_init_fds(struct proc *p)
 {
     struct vfs_file *f = 0;
     if (vfs_open("/dev/cons", VFS_O_RDONLY, 0, &f) == VFS_OK)
-        p->files[0] = f;
+        p->files->fd[0] = f;
 
     f = 0;
     if (vfs_open("/dev/cons", VFS_O_WRONLY, 0, &f) == VFS_OK) {
-        p->files[1] = f;
+        p->files->fd[1] = f;
         vfs_file_get(f);          /* share same file for stderr */
-        p->files[2] = f;
+        p->files->fd[2] = f;
     }
 }
 
 /* ---- low-level process allocator ---- */
 
-static struct proc *proc_alloc(void)
+static void proc_reap(struct work *w);
+static void reparent_children(struct proc *p);
+
+/* ---- pid hash / process list (caller holds proc_lock) ---- */
+
+static struct proc **pid_slot(u32 pid)
+{
+    return &pid_hash[(pid * 0x9E3779B1u) >> 25];   // top 7 bits: PID_HASH == 128
+}
+
+static struct proc *pid_lookup(u32 pid)
+{
+    struct proc *p = *pid_slot(pid);
+    while (p && p->pid != pid) p = p->hash_next;
+    return p;
+}
+
+static void proc_unhash(struct proc *p)
+{
+    struct proc **pp = pid_slot(p->pid);
+    while (*pp != p) pp = &(*pp)->hash_next;
+    *pp = p->hash_next;
+    list_del(&p->all_link);
+    nr_procs--;
+}
+
+/* Make child a process of parent's thread group (0: none) */
+static void link_child(struct proc *child, struct proc *parent)
 {
     acquire(&proc_lock);
-    for (int i = 0; i < MAX_PROCS; i++) {
-        if (proc_table[i].state == PROC_UNUSED) {
-            struct proc *p = &proc_table[i];
-            p->pid   = next_pid++;
-            p->state = PROC_EMBRYO;
-            release(&proc_lock);
-            p->kstack = kalloc(KSTACK_SIZE / PAGE_SIZE);
-            if (!p->kstack) { p->state = PROC_UNUSED; return 0; }
-            memset(p->kstack, 0, KSTACK_SIZE);
-            return p;
-        }
+    struct proc *leader = parent ? parent->group_leader : 0;
+    child->parent = leader;
+    child->ppid   = leader ? leader->tgid : 0;
+    if (leader) list_add_tail(&child->sibling, &leader->children);
+    release(&proc_lock);
+}
+
+static struct proc *proc_alloc(void)
+{
+    struct proc *p = kmem_cache_alloc(&proc_cache);
+    if (!p) return 0;
+    p->kstack = kalloc(KSTACK_SIZE / PAGE_SIZE);
+    if (!p->kstack) {
+        kmem_cache_free(&proc_cache, p);
+        return 0;
     }
+    memset(p->kstack, 0, KSTACK_SIZE);
+
+    p->state = PROC_EMBRYO;
+    p->group_leader = p;
+    p->nr_threads   = 1;
+    list_init(&p->children);
+    list_init(&p->sibling);
+    init_work(&p->reap_work, proc_reap);
+    sched_fork(p, current_proc);
+    p->cpu = sched_select_cpu(&p->cpus_allowed);
+
+    acquire(&proc_lock);
+    p->pid  = next_pid++;
+    p->tgid = p->pid;
+    struct proc **slot = pid_slot(p->pid);
+    p->hash_next = *slot;
+    *slot = p;
+    list_add_tail(&p->all_link, &all_procs);
+    nr_procs++;
     release(&proc_lock);
-    return 0;
+    return p;
+}
+
+/* Undo proc_alloc (plus any mm/files attached) for a never-run process */
+static void embryo_free(struct proc *p)
+{
+    if (p->mm) mm_put(p->mm);
+    if (p->files) files_put(p->files);
+    fpu_free(p);
+    kfree(p->kstack, KSTACK_SIZE / PAGE_SIZE);
+    acquire(&proc_lock);
+    proc_unhash(p);
+    if (p->group_leader != p) p->group_leader->nr_threads--;
+    release(&proc_lock);
+    kmem_cache_free(&proc_cache, p);
 }
 
 /* Called the first time a process is scheduled.
-   Releases proc_lock held by the scheduler across swtch. */
+   Releases the run queue lock held by the scheduler across swtch. */
 void forkret(void)
 {
+    release(&this_runq()->lock);
+}
+
+/* ---- kernel threads ---- */
+
+/* First schedule of a kernel thread: no trapret, straight into fn */
+static void kthread_start(void)
+{
+    struct proc *p = current_proc;
+    release(&this_runq()->lock);
+    p->kfn(p->karg);
+    kthread_exit();
+}
+
+static struct proc *kthread_spawn(const char *name, void (*fn)(void *),
+                                  void *arg, const cpumask_t *allowed)
+{
+    struct proc *p = proc_alloc();
+    if (!p) return 0;
+    p->flags = PF_KTHREAD;
+    p->cpus_allowed = *allowed;
+    p->cpu   = sched_select_cpu(allowed);
+    p->kfn   = fn;
+    p->karg  = arg;
+    int j = 0;
+    while (name[j] && j < 15) { p->name[j] = name[j]; j++; }
+    p->name[j] = 0;
+
+    /* a zero return address keeps the stack aligned as after a call */
+    u8 *sp = p->kstack + KSTACK_SIZE;
+    sp -= sizeof(u64);
+    *(u64 *)sp = 0;
+    sp -= sizeof(struct context);
+    p->context = (struct context *)sp;
+    memset(p->context, 0, sizeof(struct context));
+    p->context->rip = (u64)kthread_start;
+
+    sched_enqueue(p, ENQUEUE_NEW);
+    return p;
+}
+
+struct proc *kthread_create(const char *name, void (*fn)(void *), void *arg)
+{
+    cpumask_t all;
+    cpumask_setall(&all);
+    return kthread_spawn(name, fn, arg, &all);
+}
+
+struct proc *kthread_create_on_cpu(const char *name, void (*fn)(void *),
+                                   void *arg, u32 cpu)
+{
+    cpumask_t one;
+    cpumask_of(&one, cpu);
+    return kthread_spawn(name, fn, arg, &one);
+}
+
+/* Nobody waits for kernel threads or non-leader threads: they queue their
+   own reaping.  No preemption between queueing and PROC_DEAD, or the
+   worker could free a stack that is still runnable. */
+__attribute__((noreturn)) static void exit_self_reap(struct proc *p)
+{
+    pushcli();
+    queue_work(&p->reap_work);
+    acquire(&this_runq()->lock);
+    popcli();
+    p->state = PROC_DEAD;
+    sched();
+    panic("exit_self_reap: returned");
+}
+
+void kthread_exit(void)
+{
+    exit_self_reap(current_proc);
+}
+
+/* Runs on a worker once the process is dead: free what it still owns */
+static void proc_reap(struct work *w)
+{
+    struct proc *p = work_entry(w, struct proc, reap_work);
+    /* its CPU may still be switching away from its kstack */
+    while (__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE))
+        pause();
+    if (p->mm) {
+        mm_put(p->mm);
+        p->mm = 0;
+    }
+    proc_close_fds(p);
+    fpu_free(p);
+    kfree(p->kstack, KSTACK_SIZE / PAGE_SIZE);
+    acquire(&proc_lock);
+    /* children its threads forked after the leader exited */
+    reparent_children(p);
+    proc_unhash(p);
     release(&proc_lock);
+    kmem_cache_free(&proc_cache, p);
 }
 
 /* ---- ELF loading helper ---- */
@@ -148,9 +437,9 @@ static i32 elf_load_segments(u64 *pml4, const u8 *elf_buf, u64 elf_size, u64 *en
 
 /* Push argc/argv onto the user stack per the System V AMD64 ABI.
    Stack layout at entry (addresses grow downward):
-     [strings ...] [null] [envp ptrs...] 0 [argv ptrs...] 0 [argc]
+     [strings ...] [auxv pairs...] AT_NULL 0 [envp ptrs...] 0 [argv ptrs...] 0 [argc]
    We support only argv (no envp).  Returns the new user RSP. */
-static u64 setup_user_stack(u64 *pml4, const char *const *argv)
+static u64 setup_user_stack(u64 *pml4, const char *const *argv, u64 entry)
 {
     /* Count args and total string bytes */
     int argc = 0;
@@ -193,14 +482,28 @@ static u64 setup_user_stack(u64 *pml4, const char *const *argv)
         argv_uvas[i] = USER_STACK_BASE + (u64)(str_ptr - kpage);
     }
 
-    /* Align RSP down to 16 bytes before pushing pointer table */
+    const u64 auxv[][2] = {
+        { AT_PAGESZ,    PAGE_SIZE },
+        { AT_ENTRY,     entry },
+        { AT_VDSO_DATA, VDSO_DATA_VA },
+        { AT_NULL,      0 },
+    };
+    u64 nauxv = sizeof(auxv) / sizeof(auxv[0]);
+
+    /* Align RSP so it is 16-byte aligned again at argc (SysV entry) */
     u64 rsp = USER_STACK_BASE + (u64)(str_ptr - kpage);
     rsp &= ~(u64)15;
+    if ((2 * nauxv + argc + 3) & 1) rsp -= 8;
 
-    /* Write (from high to low): 0 (end of envp), 0 (end of argv), argv ptrs, argc */
+    /* Write (from high to low): auxv, 0 (end of envp), 0 (end of argv), argv ptrs, argc */
     /* We push via the kpage mapping */
     u64 *sp = (u64 *)(kpage + (rsp - USER_STACK_BASE));
 
+    /* auxiliary vector, AT_NULL last */
+    for (u64 i = nauxv; i-- > 0; ) {
+        sp--; *sp = auxv[i][1];
+        sp--; *sp = auxv[i][0];
+    }
     /* null envp terminator */
     sp--; *sp = 0;
     /* null argv terminator */
@@ -217,28 +520,28 @@ static u64 setup_user_stack(u64 *pml4, const char *const *argv)
     return USER_STACK_BASE + (u64)((u8 *)sp - kpage);
 }
 
+/* Fresh user registers: start at entry on user_rsp, all else zero */
+static void user_tf_init(struct trap_frame *tf, u64 entry, u64 user_rsp)
+{
+    memset(tf, 0, sizeof(struct trap_frame));
+    tf->cs     = USER_CS;
+    tf->ss     = USER_DS;
+    tf->rip    = entry;
+    tf->rsp    = user_rsp;
+    tf->rflags = 0x202;  /* IF=1 */
+}
+
 /* Set up the kernel stack for first scheduling via forkret → trapret.
-   Copies from p->tf if already set (for fork), otherwise initializes fresh. */
+   With entry == 0 the caller has already filled in proc_user_tf(p) (fork),
+   otherwise the thread starts fresh at entry on user_rsp. */
 static void kstack_setup(struct proc *p, u64 entry, u64 user_rsp)
 {
     extern void trapret(void);
 
-    u8 *sp = p->kstack + KSTACK_SIZE;
-
-    sp -= sizeof(struct trap_frame);
-    struct trap_frame *tf_on_stack = (struct trap_frame *)sp;
-
-    if (p->tf.rip != 0) {
-        memcpy(tf_on_stack, &p->tf, sizeof(struct trap_frame));
-    } else {
-        memset(tf_on_stack, 0, sizeof(struct trap_frame));
-        tf_on_stack->cs     = USER_CS;
-        tf_on_stack->ss     = USER_DS;
-        tf_on_stack->rip    = entry;
-        tf_on_stack->rsp    = user_rsp;
-        tf_on_stack->rflags = 0x202;  /* IF=1 */
-    }
+    struct trap_frame *tf = proc_user_tf(p);
+    if (entry) user_tf_init(tf, entry, user_rsp);
 
+    u8 *sp = (u8 *)tf;
     sp -= sizeof(u64);
     *(u64 *)sp = (u64)trapret;
 
@@ -248,6 +551,17 @@ static void kstack_setup(struct proc *p, u64 entry, u64 user_rsp)
     p->context->rip = (u64)forkret;
 }
 
+/* ---- basename → p->name ---- */
+
+static void proc_set_name(struct proc *p, const char *path)
+{
+    const char *name = path;
+    for (const char *s = path; *s; s++) if (*s == '/') name = s + 1;
+    int j = 0;
+    while (name[j] && j < 15) { p->name[j] = name[j]; j++; }
+    p->name[j] = 0;
+}
+
 /* ---- Read an ELF from the VFS ---- */
 
 static u8 *read_elf(const char *path, u32 *pages_out)
@@ -270,62 +584,66 @@ static u8 *read_elf(const char *path, u32 *pages_out)
     return buf;
 }
 
-/* ---- proc_create ---- */
+/* ---- image loading ---- */
 
-struct proc *proc_create(const char *path)
+/* A fresh address space holding the ELF at path, with argv on its stack
+   (argv is read from the current address space).  The new mm starts with
+   brk at USER_HEAP_BASE. */
+static struct mm *load_image(const char *path, const char *const *argv,
+                             u64 *entry_out, u64 *rsp_out)
 {
     u32 elf_pages = 0;
     u8 *elf_buf = read_elf(path, &elf_pages);
-    if (!elf_buf) {
-        klog_fail("PROC", "cannot read %s", path);
+    if (!elf_buf) { klog("EXEC", "read_elf failed for %s", path); return 0; }
+
+    struct mm *mm = mm_alloc();
+    if (!mm) { kfree(elf_buf, elf_pages); klog("EXEC", "mm_alloc failed"); return 0; }
+
+    if (elf_load_segments(mm->pml4, elf_buf, (u64)elf_pages * PAGE_SIZE, entry_out) != 0) {
+        mm_put(mm);
+        kfree(elf_buf, elf_pages);
+        klog("EXEC", "elf_load_segments failed");
         return 0;
     }
+    kfree(elf_buf, elf_pages);
 
-    struct proc *p = proc_alloc();
-    if (!p) { kfree(elf_buf, elf_pages); return 0; }
+    /* Set up argc/argv on the user stack */
+    *rsp_out = setup_user_stack(mm->pml4, argv, *entry_out);
+    return mm;
+}
 
-    p->pml4 = create_user_pml4();
-    if (!p->pml4) { kfree(elf_buf, elf_pages); p->state = PROC_UNUSED; return 0; }
+/* ---- proc_create ---- */
 
-    u64 entry = 0;
-    if (elf_load_segments(p->pml4, elf_buf, (u64)elf_pages * PAGE_SIZE, &entry) != 0) {
-        klog_fail("PROC", "ELF load failed");
-        free_user_pml4(p->pml4);
-        kfree(p->pml4, 1);
-        kfree(elf_buf, elf_pages);
-        p->state = PROC_UNUSED;
+struct proc *proc_create(const char *path)
+{
+    struct proc *p = proc_alloc();
+    if (!p) return 0;
+
+    /* a proper argv and auxv, so init starts like any exec'd program */
+    const char *const argv[] = { path, 0 };
+    u64 entry = 0, user_rsp = 0;
+    p->mm    = load_image(path, argv, &entry, &user_rsp);
+    p->files = files_alloc();
+    if (!p->mm || !p->files) {
+        klog_fail("PROC", "cannot load %s", path);
+        embryo_free(p);
         return 0;
     }
-    kfree(elf_buf, elf_pages);
+    vdso_set_pid(p->mm, p->tgid);
 
-    kstack_setup(p, entry, USER_STACK_TOP);
-    p->brk  = USER_HEAP_BASE;
-    p->ppid = 0;
+    kstack_setup(p, entry, user_rsp);
     proc_init_fds(p);
+    if (!initproc) initproc = p;
 
-    /* Copy name from basename of path */
-    const char *name = path;
-    for (const char *s = path; *s; s++) if (*s == '/') name = s + 1;
-    int j = 0;
-    while (name[j] && j < 15) { p->name[j] = name[j]; j++; }
-    p->name[j] = 0;
-
-    acquire(&proc_lock);
-    p->state = PROC_RUNNABLE;
-    release(&proc_lock);
+    proc_set_name(p, path);
 
-    // klog_ok("PROC", "pid %u  '%s'  entry=%p", p->pid, p->name, (void*)entry);
+    sched_enqueue(p, ENQUEUE_NEW);
     return p;
 }
 
-/* syscall_entry save layout from top of kstack (kstop = kstack + KSTACK_SIZE):
-     kstop-8:   user RSP
-     kstop-16:  user RIP (rcx saved by syscall instruction)
-     kstop-24:  user RFLAGS (r11 saved by syscall)
-     kstop-32:  rbx    kstop-40:  rbp    kstop-48:  r12
-     kstop-56:  r13    kstop-64:  r14    kstop-72:  r15
-     kstop-80:  rdi    kstop-88:  rsi    kstop-96:  rdx
-     kstop-104: r10    kstop-112: r8     kstop-120: r9           */
+/* Child frame from the parent's syscall frame.  The child leaves through
+   trapret/iretq rather than sysret, so rcx/r11 get what sysret would
+   have left in them. */
 static void build_fork_tf(struct trap_frame *dst, const struct trap_frame *src)
 {
     memset(dst, 0, sizeof(*dst));
@@ -361,34 +679,211 @@ i32 proc_fork(void)
     struct proc *child = proc_alloc();
     if (!child) return -1;
 
-    /* Copy address space */
-    child->pml4 = create_user_pml4();
-    if (!child->pml4) { child->state = PROC_UNUSED; return -1; }
-    copy_user_pml4(child->pml4, parent->pml4);
+    /* Copy address space; the fd table is copied too but shares the same
+       vfs_file objects (refcounted) */
+    child->mm    = mm_dup(parent->mm);
+    child->files = files_dup(parent->files);
+    if (!child->mm || !child->files || fpu_fork(child, parent) != 0) {
+        embryo_free(child);
+        return -1;
+    }
+    vdso_set_pid(child->mm, child->tgid);
 
-    /* Build child's kernel stack for forkret → trapret → iretq path.
-       Copy parent's user register state from parent->tf (embedded in proc). */
-    build_fork_tf(&child->tf, &parent->tf);
+    /* Build child's kernel stack for forkret → trapret → iretq path,
+       from the parent's registers saved by syscall_entry */
+    build_fork_tf(proc_user_tf(child), proc_user_tf(parent));
     kstack_setup(child, 0, 0);
 
-    /* Inherit fd table — share the same vfs_file objects (refcounted) */
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (parent->files[i]) {
-            vfs_file_get(parent->files[i]);
-            child->files[i] = parent->files[i];
-        }
+    /* Copy process name */
+    for (int i = 0; i < 16; i++) child->name[i] = parent->name[i];
+    link_child(child, parent);
+
+    i32 pid = (i32)child->pid;
+    sched_enqueue(child, ENQUEUE_NEW);
+    return pid;
+}
+
+/* ---- proc_clone ---- */
+
+i32 proc_clone(u64 flags, u64 entry, u64 stack, u64 arg, u64 ctid)
+{
+    struct proc *parent = current_proc;
+    if (!parent || !parent->mm) return -1;
+    if ((flags & CLONE_THREAD) && !(flags & CLONE_VM)) return -1;
+    /* a thread cannot run on its creator's stack */
+    if ((flags & CLONE_VM) && !stack) return -1;
+    if ((flags & CLONE_CHILD_CLEARTID) && !(flags & CLONE_VM)) return -1;
+
+    struct proc *child = proc_alloc();
+    if (!child) return -1;
+
+    if (flags & CLONE_VM) {
+        mm_get(parent->mm);
+        child->mm = parent->mm;
+    } else {
+        child->mm = mm_dup(parent->mm);
+    }
+    if (flags & CLONE_FILES) {
+        __atomic_add_fetch(&parent->files->refcnt, 1, __ATOMIC_RELAXED);
+        child->files = parent->files;
+    } else {
+        child->files = files_dup(parent->files);
+    }
+    if (!child->mm || !child->files || fpu_fork(child, parent) != 0) {
+        embryo_free(child);
+        return -1;
     }
 
-    /* Copy process name */
+    /* the vDSO pid is per address space: a second process in it must
+       ask the kernel */
+    if (!(flags & CLONE_VM))
+        vdso_set_pid(child->mm, child->tgid);
+    else if (!(flags & CLONE_THREAD))
+        vdso_set_pid(child->mm, 0);
+
+    if (flags & CLONE_THREAD) {
+        /* threads are not children: wait() never sees them */
+        acquire(&proc_lock);
+        struct proc *leader = parent->group_leader;
+        child->group_leader = leader;
+        child->tgid = leader->tgid;
+        child->ppid = leader->ppid;
+        leader->nr_threads++;
+        release(&proc_lock);
+    } else {
+        link_child(child, parent);
+    }
+
+    /* Same registers as the caller (rax = 0), optionally redirected to
+       entry(arg) on a fresh stack aligned as if entry had been called */
+    struct trap_frame *tf = proc_user_tf(child);
+    build_fork_tf(tf, proc_user_tf(parent));
+    if (entry) {
+        tf->rip = entry;
+        tf->rcx = entry;
+        tf->rdi = arg;
+    }
+    if (stack)
+        tf->rsp = (stack & ~0xFUL) - 8;
+    kstack_setup(child, 0, 0);
+
     for (int i = 0; i < 16; i++) child->name[i] = parent->name[i];
-    child->ppid = parent->pid;
-    child->brk  = parent->brk;
 
+    /* the shared address space is the current one */
+    if (flags & CLONE_CHILD_CLEARTID) {
+        *(volatile u32 *)ctid = child->pid;
+        child->clear_tid = ctid;
+    }
+
+    i32 tid = (i32)child->pid;
+    sched_enqueue(child, ENQUEUE_NEW);
+    return tid;
+}
+
+/* ---- proc_vfork ---- */
+
+/* A vfork child has stopped using its parent's address space.  The flag
+   lives in the parent, which is blocked and so cannot go away. */
+static void vfork_release(struct proc *p)
+{
+    if (!p->vfork_parent) return;
     acquire(&proc_lock);
-    child->state = PROC_RUNNABLE;
+    vdso_set_pid(p->vfork_parent->mm, p->vfork_parent->tgid);
+    p->vfork_parent->vfork_wait = 0;
+    wakeup(&p->vfork_parent->vfork_wait);
+    p->vfork_parent = 0;
     release(&proc_lock);
+}
 
-    return (i32)child->pid;
+/* The child borrows our address space (and stack) until it execs or
+   exits; we sleep until then so the two never run in it at once. */
+i32 proc_vfork(void)
+{
+    struct proc *parent = current_proc;
+    if (!parent || !parent->mm) return -1;
+
+    struct proc *child = proc_alloc();
+    if (!child) return -1;
+    mm_get(parent->mm);
+    child->mm    = parent->mm;
+    child->files = files_dup(parent->files);
+    if (!child->files || fpu_fork(child, parent) != 0) {
+        embryo_free(child);
+        return -1;
+    }
+
+    build_fork_tf(proc_user_tf(child), proc_user_tf(parent));
+    kstack_setup(child, 0, 0);
+    for (int i = 0; i < 16; i++) child->name[i] = parent->name[i];
+    link_child(child, parent);
+    child->vfork_parent = parent;
+    parent->vfork_wait  = 1;
+    vdso_set_pid(parent->mm, 0);    /* two processes in it until release */
+
+    i32 pid = (i32)child->pid;
+    sched_enqueue(child, ENQUEUE_NEW);
+    acquire(&proc_lock);
+    while (parent->vfork_wait)
+        sleep(&parent->vfork_wait, &proc_lock);
+    release(&proc_lock);
+    return pid;
+}
+
+/* ---- proc_spawn ---- */
+
+/* Apply dup2/close actions to a not yet running child's fd table */
+static i32 spawn_fds(struct proc *child, const struct spawn_action *acts, u32 nacts)
+{
+    for (u32 i = 0; i < nacts; i++) {
+        const struct spawn_action *a = &acts[i];
+        if (a->fd < 0 || a->fd >= MAX_FDS) return -1;
+        struct vfs_file *old;
+        switch (a->op) {
+        case SPAWN_DUP2: {
+            if (a->newfd < 0 || a->newfd >= MAX_FDS) return -1;
+            struct vfs_file *f = fd_get(child, a->fd);
+            if (!f) return -1;
+            if (a->fd == a->newfd) continue;
+            vfs_file_get(f);
+            old = fd_install(child, a->newfd, f);
+            break;
+        }
+        case SPAWN_CLOSE:
+            old = fd_install(child, a->fd, 0);
+            break;
+        default:
+            return -1;
+        }
+        if (old) vfs_close(old);
+    }
+    return 0;
+}
+
+i32 proc_spawn(const char *path, const char *const *argv,
+               const struct spawn_action *acts, u32 nacts)
+{
+    struct proc *parent = current_proc;
+    if (!parent) return -1;
+
+    struct proc *child = proc_alloc();
+    if (!child) return -1;
+
+    u64 entry = 0, user_rsp = 0;
+    child->mm    = load_image(path, argv, &entry, &user_rsp);
+    child->files = files_dup(parent->files);
+    if (!child->mm || !child->files || spawn_fds(child, acts, nacts) != 0) {
+        embryo_free(child);
+        return -1;
+    }
+    vdso_set_pid(child->mm, child->tgid);
+
+    kstack_setup(child, entry, user_rsp);
+    proc_set_name(child, path);
+    link_child(child, parent);
+
+    i32 pid = (i32)child->pid;
+    sched_enqueue(child, ENQUEUE_NEW);
+    return pid;
 }
 
 /* ---- proc_exec ---- */
@@ -398,111 +893,367 @@ i32 proc_exec(const char *path, const char *const *argv)
     struct proc *p = current_proc;
     if (!p) return -1;
 
-    u32 elf_pages = 0;
-    u8 *elf_buf = read_elf(path, &elf_pages);
-    if (!elf_buf) { klog("EXEC", "read_elf failed for %s", path); return -1; }
-    // klog("EXEC", "read_elf ok, %u pages", elf_pages);
-
-    /* Build new address space before tearing down the old one */
-    u64 *new_pml4 = create_user_pml4();
-    if (!new_pml4) { kfree(elf_buf, elf_pages); klog("EXEC", "create_user_pml4 failed"); return -1; }
-    // klog("EXEC", "create_user_pml4 ok");
-
-    u64 entry = 0;
-    if (elf_load_segments(new_pml4, elf_buf, (u64)elf_pages * PAGE_SIZE, &entry) != 0) {
-        free_user_pml4(new_pml4);
-        kfree(new_pml4, 1);
-        kfree(elf_buf, elf_pages);
-        klog("EXEC", "elf_load_segments failed");
-        return -1;
-    }
-    // klog("EXEC", "elf_load_segments ok, entry=%x", entry);
-    kfree(elf_buf, elf_pages);
-
-    /* Set up argc/argv on the user stack */
-    u64 user_rsp = setup_user_stack(new_pml4, argv);
-    // klog("EXEC", "setup_user_stack ok, rsp=%x", user_rsp);
-
-    /* Reset heap break (can be done before or after lcr3) */
-    p->brk = USER_HEAP_BASE;
-    // klog("EXEC", "brk reset");
-
-    /* Redirect the pending sysret to the new entry point.
-       syscall_entry saved user RIP at kstop-16 and user RSP at kstop-8.
-       After proc_exec returns through syscall_handler → syscall_entry,
-       those values are restored and sysret jumps to the new entry.
-
-       IMPORTANT: This MUST be done BEFORE lcr3 switches to the new address space,
-       because p->kstack is a kernel virtual address that may not be accessible
-       in the new user page tables (which only have the kernel half mapped). */
-    u64 kstop = (u64)p->kstack + KSTACK_SIZE;
-    *(u64 *)(kstop -   8) = user_rsp;  /* new user RSP */
-    *(u64 *)(kstop -  16) = entry;     /* new user RIP */
-    *(u64 *)(kstop -  24) = 0x202;     /* new user RFLAGS: IF=1 */
-    // klog("EXEC", "kstack patched, entry=%x rsp=%x", entry, user_rsp);
-
-    /* Update p->tf for fork()-after-exec() consistency */
-    p->tf.rip = entry;
-    p->tf.rsp = user_rsp;
-    p->tf.rflags = 0x202;
-    p->tf.cs = USER_CS;
-    p->tf.ss = USER_DS;
-    // klog("EXEC", "p->tf updated");
-
-    /* Tear down old address space and switch */
-    u64 *old_pml4 = p->pml4;
-    p->pml4 = new_pml4;
-    free_user_pml4(old_pml4);
-    kfree(old_pml4, 1);
+    /* Build new address space before tearing down the old one.  Other
+       threads sharing the old one keep it until they exit. */
+    u64 entry = 0, user_rsp = 0;
+    struct mm *new_mm = load_image(path, argv, &entry, &user_rsp);
+    if (!new_mm) return -1;
+    vdso_set_pid(new_mm, p->tgid);
+    u64 *new_pml4 = new_mm->pml4;
+
+    /* Redirect the pending sysret to the new entry point with a clean
+       register set: syscall_entry restores everything from this frame */
+    user_tf_init(proc_user_tf(p), entry, user_rsp);
+
+    /* Switch, then drop our reference to the old address space */
+    struct mm *old_mm = p->mm;
+    p->mm = new_mm;
     lcr3(VIRT_TO_PHYS((u64)new_pml4));
+    mm_put(old_mm);
+    vfork_release(p);
+    fpu_release(p);
     // klog("EXEC", "lcr3 done");
 
-    /* Update name */
-    const char *name = path;
-    for (const char *s = path; *s; s++) if (*s == '/') name = s + 1;
-    int j = 0;
-    while (name[j] && j < 15) { p->name[j] = name[j]; j++; }
-    p->name[j] = 0;
+    proc_set_name(p, path);
 
-    /* Return 0 — sysret uses the patched saved values above */
-    // klog("EXEC", "returning 0");
+    /* 0 lands in the fresh frame's rax, as the new image expects */
     return 0;
 }
 
-/* ---- yield / scheduler ---- */
+/* ---- exit / wait ---- */
 
-void yield(void)
+/* A process is done once its leader is a zombie and its last thread is
+   gone.  Its parent gets to reap it; a parentless one (kernel-started, or
+   orphaned with no init to adopt it) is reaped right away.  The caller
+   holds proc_lock but no run queue lock: both paths may enqueue a task. */
+static void group_done(struct proc *leader)
+{
+    if (leader->parent) {
+        wakeup(leader->parent);
+    } else {
+        queue_work(&leader->reap_work);
+        leader->state = PROC_DEAD;
+    }
+}
+
+/* Hand p's children to init (caller holds proc_lock) */
+static void reparent_children(struct proc *p)
+{
+    struct proc *to = initproc != p ? initproc : 0;
+    list_for_each_safe(n, &p->children) {
+        struct proc *c = list_entry(n, struct proc, sibling);
+        list_del(&c->sibling);
+        c->parent = to;
+        c->ppid   = to ? to->tgid : 0;
+        if (to) list_add_tail(&c->sibling, &to->children);
+        if (c->state == PROC_ZOMBIE && c->nr_threads == 0)
+            group_done(c);
+    }
+}
+
+/* Parents sleep on their group leader's struct proc under proc_lock; the
+   state changes that make a child reapable and the wakeup happen under it
+   too, so none is lost.  Only thread group leaders are waited for, and
+   only after the whole group has exited: the other threads still point
+   at the leader. */
+void proc_exit(i32 status)
 {
     struct cpu *c = mycpu();
     struct proc *p = c->proc;
-    if (!p) return;
+
+    proc_close_fds(p);
+
+    /* pthread_join: the address space is still the current one */
+    if (p->clear_tid) {
+        *(volatile u32 *)p->clear_tid = 0;
+        futex_wake(p->mm, p->clear_tid, 1);
+        p->clear_tid = 0;
+    }
+
+    if (p->pid != p->tgid) {
+        struct proc *leader = p->group_leader;
+        acquire(&proc_lock);
+        rusage_add(&leader->exited_ru, &p->ru);
+        if (--leader->nr_threads == 0 && leader->state == PROC_ZOMBIE)
+            group_done(leader);
+        release(&proc_lock);
+        exit_self_reap(p);
+    }
+    vfork_release(p);
+
+    printf("proc: %d, code: %d\r\n", p->pid, status);
+
     acquire(&proc_lock);
-    p->state = PROC_RUNNABLE;
-    c->proc = NULL;
-    swtch(&p->context, c->scheduler_ctx);
+    p->exit_code = status;
+    reparent_children(p);
+    /* the parent can't look before proc_lock is dropped, nor the reaper
+       before we are off the CPU; group_done marks a parentless one DEAD */
+    if (--p->nr_threads == 0)
+        group_done(p);
+    /* the run queue lock is held until the scheduler is off our stack */
+    acquire(&this_runq()->lock);
+    if (p->state != PROC_DEAD) p->state = PROC_ZOMBIE;
     release(&proc_lock);
+    sched();
+
+    panic("proc_exit: returned");
 }
 
-void scheduler(void)
+i32 proc_wait(i32 *status_out, struct rusage *ru_out)
 {
-    struct cpu *c = mycpu();
+    struct proc *parent = current_proc->group_leader;
+
+    acquire(&proc_lock);
     for (;;) {
-        sti();
-        acquire(&proc_lock);
-        for (int i = 0; i < MAX_PROCS; i++) {
-            struct proc *p = &proc_table[i];
-            if (p->state != PROC_RUNNABLE) continue;
-            p->state = PROC_RUNNING;
-            c->proc  = p;
+        if (list_empty(&parent->children)) {
+            release(&proc_lock);
+            return -1;
+        }
+        list_for_each(n, &parent->children) {
+            struct proc *c = list_entry(n, struct proc, sibling);
+            if (c->state != PROC_ZOMBIE || c->nr_threads != 0) continue;
+            i32 pid = (i32)c->pid;
+            if (status_out) *status_out = c->exit_code;
+            /* every thread of c has exited: its totals are final */
+            struct rusage total = c->ru;
+            rusage_add(&total, &c->exited_ru);
+            rusage_add(&total, &c->child_ru);
+            rusage_add(&parent->child_ru, &total);
+            if (ru_out) *ru_out = total;
+            list_del(&c->sibling);
+            /* tearing down the address space is off the parent's path */
+            c->state = PROC_DEAD;
+            queue_work(&c->reap_work);
+            release(&proc_lock);
+            return pid;
+        }
+        sleep(parent, &proc_lock);
+    }
+}
 
-            lcr3(VIRT_TO_PHYS((u64)p->pml4));
-            tss_set_rsp0((u64)p->kstack + KSTACK_SIZE);
-            c->kernel_rsp = (u64)p->kstack + KSTACK_SIZE;
+/* ---- resource accounting ---- */
+
+void acct_enter_kernel(void)
+{
+    struct proc *p = current_proc;
+    if (!p) return;
+    u64 now = tsc_to_ns(rdtsc());
+    p->ru.utime_ns += now - p->acct_ts;
+    p->acct_ts = now;
+}
 
-            swtch(&c->scheduler_ctx, p->context);
+void acct_exit_kernel(void)
+{
+    struct proc *p = current_proc;
+    if (!p) return;
+    u64 now = tsc_to_ns(rdtsc());
+    p->ru.stime_ns += now - p->acct_ts;
+    p->acct_ts = now;
+}
 
-            c->proc = 0;
+i32 proc_getrusage(i32 who, struct rusage *out)
+{
+    struct proc *self = current_proc;
+    struct proc *leader = self->group_leader;
+    acct_exit_kernel();     /* bring our own stime up to now */
+    memset(out, 0, sizeof(*out));
+    switch (who) {
+    case RUSAGE_THREAD:
+        *out = self->ru;
+        return 0;
+    case RUSAGE_CHILDREN:
+        acquire(&proc_lock);
+        *out = leader->child_ru;
+        release(&proc_lock);
+        return 0;
+    case RUSAGE_SELF:
+        acquire(&proc_lock);
+        *out = leader->exited_ru;
+        list_for_each(n, &all_procs) {
+            struct proc *p = list_entry(n, struct proc, all_link);
+            if (p->tgid == self->tgid && p->state != PROC_DEAD)
+                rusage_add(out, &p->ru);
         }
         release(&proc_lock);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* ---- nice / ps ---- */
+
+i32 proc_set_nice(u32 pid, i32 nice)
+{
+    struct proc *self = current_proc;
+    if (pid == 0) pid = self->pid;
+    acquire(&proc_lock);
+    struct proc *p = pid_lookup(pid);
+    if (p) sched_set_nice(p, nice);
+    release(&proc_lock);
+    return p ? 0 : -1;
+}
+
+/* Kernel threads stay in the fair class */
+i32 proc_set_scheduler(u32 pid, u32 policy, u32 prio)
+{
+    struct proc *self = current_proc;
+    if (pid == 0 || pid == self->pid) {
+        /* not under proc_lock: losing priority may yield */
+        if (self->flags & PF_KTHREAD) return -1;
+        return sched_set_policy(self, policy, prio);
+    }
+    acquire(&proc_lock);
+    struct proc *p = pid_lookup(pid);
+    int ok = p && p->state != PROC_DEAD && !(p->flags & PF_KTHREAD);
+    i32 r = ok ? sched_set_policy(p, policy, prio) : -1;
+    release(&proc_lock);
+    return r;
+}
+
+i32 proc_get_scheduler(u32 pid, u32 *prio)
+{
+    struct proc *self = current_proc;
+    if (pid == 0) pid = self->pid;
+    acquire(&proc_lock);
+    struct proc *p = pid_lookup(pid);
+    i32 policy = p ? (i32)p->policy : -1;
+    if (p) *prio = p->rt_priority;
+    release(&proc_lock);
+    return policy;
+}
+
+/* Kernel threads keep the affinity they were created with */
+i32 proc_set_affinity(u32 pid, const cpumask_t *mask)
+{
+    struct proc *self = current_proc;
+    if (!cpumask_any_online(mask)) return -1;
+    if (pid == 0 || pid == self->pid) {
+        /* not under proc_lock: moving ourselves off this CPU yields */
+        sched_set_affinity(self, mask);
+        return 0;
+    }
+    acquire(&proc_lock);
+    struct proc *p = pid_lookup(pid);
+    int ok = p && p->state != PROC_DEAD && !(p->flags & PF_KTHREAD);
+    if (ok) sched_set_affinity(p, mask);
+    release(&proc_lock);
+    return ok ? 0 : -1;
+}
+
+i32 proc_get_affinity(u32 pid, cpumask_t *mask)
+{
+    struct proc *self = current_proc;
+    if (pid == 0) pid = self->pid;
+    acquire(&proc_lock);
+    struct proc *p = pid_lookup(pid);
+    if (p) *mask = p->cpus_allowed;
+    release(&proc_lock);
+    return p ? 0 : -1;
+}
+
+static const char *const proc_state_names[] = {
+    [PROC_UNUSED]   = "unused",
+    [PROC_EMBRYO]   = "embryo",
+    [PROC_RUNNABLE] = "runnable",
+    [PROC_RUNNING]  = "running",
+    [PROC_ZOMBIE]   = "zombie",
+    [PROC_SLEEPING] = "sleeping",
+    [PROC_DEAD]     = "dead",
+};
+
+/* Times in microseconds; vruntime is weighted, runtime and wait are wall */
+#define PS_LINE_MAX 128
+static i64 ps_dev_read(struct vfs_file *f, void *buf, u64 count, vfs_off_t *off)
+{
+    (void)f;
+    /* sized from an unlocked count; late arrivals may get truncated */
+    u64 pages = ((u64)nr_procs + 4) * PS_LINE_MAX / PAGE_SIZE + 1;
+    char *tmp = kalloc(pages);
+    if (!tmp) return VFS_ENOMEM;
+    u64 cap = pages * PAGE_SIZE;
+    u64 len = ksnprintf(tmp, cap,
+                        "PID  TGID PPID STATE     CPU MASK POL    PRIO NICE VRUNTIME   RUNTIME    WAIT       NAME\n");
+    acquire(&proc_lock);
+    list_for_each(n, &all_procs) {
+        struct proc *p = list_entry(n, struct proc, all_link);
+        len += ksnprintf(tmp + len, cap - len,
+                         "%-4u %-4u %-4u %-9s %-3u %-4x %-6s %-4u %-4d %-10u %-10u %-10u %s\n",
+                         (u64)p->pid, (u64)p->tgid, (u64)p->ppid, proc_state_names[p->state],
+                         (u64)p->cpu, p->cpus_allowed.bits[0], sched_policy_name(p->policy),
+                         (u64)p->rt_priority, (i64)p->nice, p->vruntime / 1000,
+                         p->sum_exec / 1000, p->wait_sum / 1000, p->name);
     }
+    release(&proc_lock);
+    i64 n = devfs_read_text(tmp, len, buf, count, off);
+    kfree(tmp, pages);
+    return n;
+}
+
+static const struct vfs_file_ops ps_dev_fops = {
+    .read = ps_dev_read,
+};
+
+/* Per-thread counters; times in microseconds, I/O in bytes */
+static i64 rusage_dev_read(struct vfs_file *f, void *buf, u64 count, vfs_off_t *off)
+{
+    (void)f;
+    u64 pages = ((u64)nr_procs + 4) * PS_LINE_MAX / PAGE_SIZE + 1;
+    char *tmp = kalloc(pages);
+    if (!tmp) return VFS_ENOMEM;
+    u64 cap = pages * PAGE_SIZE;
+    u64 len = ksnprintf(tmp, cap,
+                        "PID  UTIME      STIME      VCSW     IVCSW    READ       WRITTEN    BLKIO      NAME\n");
+    acquire(&proc_lock);
+    list_for_each(n, &all_procs) {
+        struct proc *p = list_entry(n, struct proc, all_link);
+        const struct rusage *ru = &p->ru;
+        len += ksnprintf(tmp + len, cap - len,
+                         "%-4u %-10u %-10u %-8u %-8u %-10u %-10u %-10u %s\n",
+                         (u64)p->pid, ru->utime_ns / 1000, ru->stime_ns / 1000,
+                         ru->nvcsw, ru->nivcsw, ru->read_bytes,
+                         ru->write_bytes, ru->blkio_ns / 1000, p->name);
+    }
+    release(&proc_lock);
+    i64 n = devfs_read_text(tmp, len, buf, count, off);
+    kfree(tmp, pages);
+    return n;
+}
+
+static const struct vfs_file_ops rusage_dev_fops = {
+    .read = rusage_dev_read,
+};
+
+/* Per-thread wakeup -> run latency; buckets as in /dev/sched */
+#define SCHEDLAT_LINE_MAX 256
+static i64 schedlat_dev_read(struct vfs_file *f, void *buf, u64 count, vfs_off_t *off)
+{
+    (void)f;
+    u64 pages = ((u64)nr_procs + 4) * SCHEDLAT_LINE_MAX / PAGE_SIZE + 1;
+    char *tmp = kalloc(pages);
+    if (!tmp) return VFS_ENOMEM;
+    u64 cap = pages * PAGE_SIZE;
+    u64 len = ksnprintf(tmp, cap, "PID  NAME             WAKEUP LATENCY (log2 us: <1 1 2 4 ...)\n");
+    acquire(&proc_lock);
+    list_for_each(n, &all_procs) {
+        struct proc *p = list_entry(n, struct proc, all_link);
+        len += ksnprintf(tmp + len, cap - len, "%-4u %-16s ", (u64)p->pid, p->name);
+        len += lat_hist_format(tmp + len, cap - len, &p->wakeup_lat);
+        len += ksnprintf(tmp + len, cap - len, "\n");
+    }
+    release(&proc_lock);
+    i64 n = devfs_read_text(tmp, len, buf, count, off);
+    kfree(tmp, pages);
+    return n;
+}
+
+static const struct vfs_file_ops schedlat_dev_fops = {
+    .read = schedlat_dev_read,
+};
+
+void proc_devfs_init(void)
+{
+    devfs_register("ps", VFS_S_IFCHR | 0444, &ps_dev_fops, 0);
+    devfs_register("rusage", VFS_S_IFCHR | 0444, &rusage_dev_fops, 0);
+    devfs_register("schedlat", VFS_S_IFCHR | 0444, &schedlat_dev_fops, 0);
 }
@@ -1,22 +1,34 @@
 #pragma once
 #include "types.h"
 #include "spinlock.h"
+#include "cpumask.h"
+#include "list.h"
 #include "vfs.h"
 #include "idt.h"
+#include "sched.h"
+#include "timer.h"
+#include "workqueue.h"
 
-#define MAX_PROCS    64
 #define KSTACK_SIZE  (4096 * 2)  // 8KB kernel stack
 #define USER_STACK_TOP  0x7FFFFFF000UL
 #define USER_STACK_BASE 0x7FFFFFE000UL
 #define USER_HEAP_BASE  0x40000000UL    // brk starts here
+#define USER_HEAP_MAX   0x400000000UL   // brk ceiling
+#define USER_FB_BASE    0x500000000UL   // framebuffer mapping (SYS_FBINFO)
 #define MAX_FDS      32
 
 // Process states
-#define PROC_UNUSED   0
+#define PROC_UNUSED   0   // never set once allocated (structs come from a slab)
 #define PROC_EMBRYO   1
 #define PROC_RUNNABLE 2
 #define PROC_RUNNING  3
 #define PROC_ZOMBIE   4   // exited, waiting for parent to wait()
+#define PROC_SLEEPING 5   // blocked in sleep() on chan
+#define PROC_DEAD     6   // reaped; a worker frees its memory
+
+// Process flags
+#define PF_KTHREAD    0x1 // kernel thread: no user address space
+#define PF_KILLED     0x2 // exit(-1) on the way out of the current trap
 
 // Saved by swtch(), restored when switching to a process
 struct context {
@@ -29,28 +41,124 @@ struct context {
     u64 rip;
 };
 
+/* Address space, shared by the threads of a process (CLONE_VM) */
+struct mm {
+    struct spinlock lock;   // brk and page table updates
+    u64 *pml4;              // page table (virtual address)
+    u64 brk;                // current heap break (user VA)
+    struct vdso_proc *vdso; // this address space's vDSO page
+    volatile u32 refcnt;
+};
+
+/* Open file descriptors, shared by the threads of a process (CLONE_FILES) */
+struct files {
+    struct spinlock lock;   // slot allocation and replacement
+    struct vfs_file *fd[MAX_FDS];
+    volatile u32 refcnt;
+};
+
+/* Resource usage; times in ns */
+struct rusage {
+    u64 utime_ns;           // running in user mode
+    u64 stime_ns;           // running in the kernel
+    u64 nvcsw;              // voluntary context switches (blocked)
+    u64 nivcsw;             // involuntary context switches (preempted)
+    u64 read_bytes;         // through vfs_read
+    u64 write_bytes;        // through vfs_write
+    u64 blkio_ns;           // blocked waiting for block I/O
+};
+
+static inline void rusage_add(struct rusage *dst, const struct rusage *src)
+{
+    dst->utime_ns    += src->utime_ns;
+    dst->stime_ns    += src->stime_ns;
+    dst->nvcsw       += src->nvcsw;
+    dst->nivcsw      += src->nivcsw;
+    dst->read_bytes  += src->read_bytes;
+    dst->write_bytes += src->write_bytes;
+    dst->blkio_ns    += src->blkio_ns;
+}
+
+#define RUSAGE_SELF      0    // every thread of the calling process
+#define RUSAGE_CHILDREN  (-1) // reaped children and their reaped children
+#define RUSAGE_THREAD    1    // the calling thread
+
+/* One schedulable thread.  Process-wide state lives in mm and files;
+   tgid names the process (the pid of its first thread). */
 struct proc {
-    u32 pid;
+    u32 pid;                // thread id
     u32 ppid;               // parent pid
     u32 state;
     i32 exit_code;          // set on exit, read by wait()
-    u64 *pml4;              // page table (virtual address)
+    struct mm *mm;          // address space (0 for kernel threads)
     u8  *kstack;            // kernel stack base (virtual)
     struct context *context;
-    struct trap_frame tf;   // trap frame (stored in-proc)
-    u64 brk;                // current heap break (user VA)
+    u32 tgid;               // thread group = process id
     char name[16];
-    struct vfs_file *files[MAX_FDS]; // open file descriptors
+    struct files *files;    // open file descriptors
+    u64 clear_tid;          // user u32 zeroed and futex-woken at exit
+    struct proc *vfork_parent; // blocked in vfork until we exec or exit
+    int vfork_wait;         // (parent side) vfork child still using our mm
+    struct proc *parent;    // leader of the parent process (0: none / thread)
+    struct proc *group_leader; // first thread of our process (self for leaders)
+    u32 nr_threads;         // (leader) threads of the group not yet exited
+    struct list_head children; // (leader) child processes, via their sibling
+    struct list_head sibling;
+    struct list_head all_link; // every allocated proc, for /dev/ps
+    struct proc *hash_next; // pid hash chain
+    u64 acct_ts;            // ns: last user/kernel/switch accounting point
+    struct rusage ru;       // this thread
+    struct rusage exited_ru;   // (leader) threads that already exited
+    struct rusage child_ru;    // (leader) reaped children
+    u32 cpu;                // run queue it is queued on / last ran on; that rq lock held to write
+    cpumask_t cpus_allowed; // CPUs it may run on (inherited across fork)
+    volatile u32 on_cpu;    // context still live on a CPU (cleared after swtch)
+    u64 last_ran;           // TSC when last switched out (cache-hot test)
+    struct rb_node rq_node; // run queue link (keyed by vruntime)
+    i32 nice;               // NICE_MIN..NICE_MAX
+    u32 weight;             // load weight derived from nice
+    u32 policy;             // SCHED_NORMAL / SCHED_FIFO / SCHED_RR
+    u32 rt_priority;        // SCHED_RT_PRIO_MIN..MAX, 0 for SCHED_NORMAL
+    struct list_head rt_link; // run queue link (real-time)
+    u64 rt_slice;           // ns left of the SCHED_RR slice
+    u8  on_rq;              // queued on runqs[cpu] (not running, not in transit)
+    u8  yielded;            // switched out runnable: its CPU requeues it
+    u64 vruntime;           // weighted ns of CPU consumed
+    u64 exec_start;         // ns: start of the current accounting period
+    u64 sum_exec;           // ns spent running
+    u64 wait_start;         // ns: queued since
+    u64 wait_sum;           // ns spent runnable but waiting for a CPU
+    u64 wakeup_ts;          // ns: woken and not yet run (0: not woken)
+    u32 waker_cpu;          // CPU that issued that wakeup
+    struct lat_hist wakeup_lat; // wakeup -> run
+    void *chan;             // sleep channel (PROC_SLEEPING)
+    struct proc *wq_next;   // sleep queue link
+    struct hrtimer sleep_timer; // ends a timed sleep (timer.c)
+    u32 flags;              // PF_*
+    u8 *fpu_area;           // saved x87/SSE/AVX state (0 until first use)
+    u32 fpu_cpu;            // 1 + CPU it last loaded the state on (0: none)
+    u8  fpu_used;           // slices in a row that used the FPU (fpu.c)
+    void (*kfn)(void *);    // kernel thread body
+    void *karg;
+    struct work reap_work;  // frees kstack/pml4 once off the CPU
 };
 
-// Assembly context switch: saves old context, loads new
-void swtch(struct context **old, struct context *new_ctx);
+// User registers of a thread in the kernel.  syscall_entry and isr_common
+// both save them at the top of its kernel stack (the TSS rsp0), and a new
+// thread leaves through trapret from the same place.
+static inline struct trap_frame *proc_user_tf(struct proc *p)
+{
+    return (struct trap_frame *)(p->kstack + KSTACK_SIZE) - 1;
+}
 
-// Scheduler (called from kmain, never returns)
-void scheduler(void);
+// clone() flags (Linux values)
+#define CLONE_VM             0x00000100  // share the address space and brk
+#define CLONE_FILES          0x00000400  // share the fd table
+#define CLONE_THREAD         0x00010000  // same thread group (requires CLONE_VM)
+#define CLONE_CHILD_CLEARTID 0x00200000  // store tid at ctid; zero + wake it on exit
 
-// Yield current process (called from timer interrupt)
-void yield(void);
+// Assembly context switch: saves old context, loads new
+void swtch(struct context **old, struct context *new_ctx);
 
 // Create a process from an ELF file path
 struct proc *proc_create(const char *path);
@@ -58,15 +166,82 @@ struct proc *proc_create(const char *path);
 // Fork the current process; returns child pid in parent, 0 in child
 i32 proc_fork(void);
 
+// Create a thread/process running entry(arg) on stack (CLONE_* flags).
+// Returns the new tid.
+i32 proc_clone(u64 flags, u64 entry, u64 stack, u64 arg, u64 ctid);
+
+// Fork sharing the address space; the caller sleeps until the child execs
+// or exits. Returns child pid in parent, 0 in child.
+i32 proc_vfork(void);
+
+// spawn() file actions, applied in order to the child's copy of the
+// caller's fd table
+#define SPAWN_DUP2  0   // dup fd onto newfd
+#define SPAWN_CLOSE 1   // close fd
+#define SPAWN_MAX_ACTIONS 16
+struct spawn_action {
+    i32 op;
+    i32 fd;
+    i32 newfd;
+};
+
+// Start the ELF at path with argv in a new process, without copying the
+// caller's address space. Returns the child pid or -1.
+i32 proc_spawn(const char *path, const char *const *argv,
+               const struct spawn_action *acts, u32 nacts);
+
 // Replace current process address space with the ELF at path + argv
 i32 proc_exec(const char *path, const char *const *argv);
 
+// Start a kernel thread running fn(arg) with interrupts enabled; it is
+// scheduled like any process. Returning from fn exits the thread.
+struct proc *kthread_create(const char *name, void (*fn)(void *), void *arg);
+// Same, bound to cpu
+struct proc *kthread_create_on_cpu(const char *name, void (*fn)(void *),
+                                   void *arg, u32 cpu);
+__attribute__((noreturn)) void kthread_exit(void);
+
+// Terminate the calling thread.  A thread group leader becomes a zombie
+// and wakes a parent blocked in proc_wait; other threads reap themselves.
+__attribute__((noreturn)) void proc_exit(i32 status);
+
+// Sleep until a child exits, reap it and return its pid (-1: no children).
+// ru_out (may be 0) receives the child's totals, its own children included.
+i32 proc_wait(i32 *status_out, struct rusage *ru_out);
+
+// Resource usage of the caller (RUSAGE_*); returns 0 or -1
+i32 proc_getrusage(i32 who, struct rusage *out);
+
+// User/kernel time split: call on entry from user mode (syscall or
+// interrupt with a user CS) and just before returning there
+void acct_enter_kernel(void);
+void acct_exit_kernel(void);
+
+// Set the nice value of pid (0 = caller); returns 0 or -1 if not found
+i32 proc_set_nice(u32 pid, i32 nice);
+
+// Set / read the scheduling policy and real-time priority of thread pid
+// (0 = caller).  Set returns -1 for a bad policy/priority or no such user
+// thread; get returns the policy and stores the priority, or -1.
+i32 proc_set_scheduler(u32 pid, u32 policy, u32 prio);
+i32 proc_get_scheduler(u32 pid, u32 *prio);
+
+// Set / read the CPU affinity of thread pid (0 = caller).  Returns -1 if
+// there is no such user thread or mask names no online CPU.
+i32 proc_set_affinity(u32 pid, const cpumask_t *mask);
+i32 proc_get_affinity(u32 pid, cpumask_t *mask);
+
 // Initialize process subsystem (call before proc_create)
 void proc_init(void);
 
+// Register /dev/ps, /dev/rusage and /dev/schedlat (call after devfs_init)
+void proc_devfs_init(void);
+
 // File descriptor helpers
 i32 fd_alloc(struct proc *p, struct vfs_file *f);   // returns fd or -1
 struct vfs_file *fd_get(struct proc *p, i32 fd);    // returns file or NULL
+// Put f (may be 0) in slot fd; returns what was there for the caller to close
+struct vfs_file *fd_install(struct proc *p, i32 fd, struct vfs_file *f);
 
 // Lock helpers for use by syscall.c
 void acquire_proc_lock(void);
@@ -77,4 +252,4 @@ void release_proc_lock(void);
 
 // Get scheduler context pointer (for syscall exit path)
 struct context **cpu_context_ptr(void);
-void proc_close_fds(struct proc *p);  // close all open file descriptors
+void proc_close_fds(struct proc *p);  // drop p's fd table (closes on last ref)
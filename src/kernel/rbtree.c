@@ -0,0 +1,194 @@
+#include "rbtree.h"
+
+/* Classic red-black tree with parent pointers; null children are black. */
+
+static void replace_child(struct rb_root *root, struct rb_node *parent,
+                          struct rb_node *old, struct rb_node *new_node)
+{
+    if (!parent)                  root->node    = new_node;
+    else if (parent->left == old) parent->left  = new_node;
+    else                          parent->right = new_node;
+}
+
+static void rotate_left(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->right;
+    x->right = y->left;
+    if (y->left) y->left->parent = x;
+    y->parent = x->parent;
+    replace_child(root, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void rotate_right(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->left;
+    x->left = y->right;
+    if (y->right) y->right->parent = x;
+    y->parent = x->parent;
+    replace_child(root, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+static int is_red(const struct rb_node *n) { return n && n->red; }
+
+void rb_insert_color(struct rb_node *n, struct rb_root *root)
+{
+    struct rb_node *p;
+    while ((p = n->parent) && p->red) {
+        struct rb_node *g = p->parent;   // exists: a red node is never the root
+        if (p == g->left) {
+            struct rb_node *u = g->right;
+            if (is_red(u)) {
+                p->red = u->red = 0;
+                g->red = 1;
+                n = g;
+                continue;
+            }
+            if (n == p->right) {
+                rotate_left(root, p);
+                n = p;
+                p = n->parent;
+            }
+            p->red = 0;
+            g->red = 1;
+            rotate_right(root, g);
+        } else {
+            struct rb_node *u = g->left;
+            if (is_red(u)) {
+                p->red = u->red = 0;
+                g->red = 1;
+                n = g;
+                continue;
+            }
+            if (n == p->left) {
+                rotate_right(root, p);
+                n = p;
+                p = n->parent;
+            }
+            p->red = 0;
+            g->red = 1;
+            rotate_left(root, g);
+        }
+    }
+    root->node->red = 0;
+}
+
+/* x (possibly null) took the place of a removed black node under parent */
+static void erase_fixup(struct rb_root *root, struct rb_node *x,
+                        struct rb_node *parent)
+{
+    while (x != root->node && !is_red(x)) {
+        if (x == parent->left) {
+            struct rb_node *w = parent->right;
+            if (w->red) {
+                w->red = 0;
+                parent->red = 1;
+                rotate_left(root, parent);
+                w = parent->right;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = 1;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (!is_red(w->right)) {
+                w->left->red = 0;
+                w->red = 1;
+                rotate_right(root, w);
+                w = parent->right;
+            }
+            w->red = parent->red;
+            parent->red = 0;
+            if (w->right) w->right->red = 0;
+            rotate_left(root, parent);
+        } else {
+            struct rb_node *w = parent->left;
+            if (w->red) {
+                w->red = 0;
+                parent->red = 1;
+                rotate_right(root, parent);
+                w = parent->left;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = 1;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (!is_red(w->left)) {
+                w->right->red = 0;
+                w->red = 1;
+                rotate_left(root, w);
+                w = parent->left;
+            }
+            w->red = parent->red;
+            parent->red = 0;
+            if (w->left) w->left->red = 0;
+            rotate_right(root, parent);
+        }
+        x = root->node;
+    }
+    if (x) x->red = 0;
+}
+
+void rb_erase(struct rb_node *n, struct rb_root *root)
+{
+    struct rb_node *child, *parent;
+    int red;
+
+    if (!n->left || !n->right) {
+        child  = n->left ? n->left : n->right;
+        parent = n->parent;
+        red    = n->red;
+        if (child) child->parent = parent;
+        replace_child(root, parent, n, child);
+    } else {
+        /* splice out the in-order successor and put it in n's place */
+        struct rb_node *s = n->right;
+        while (s->left) s = s->left;
+        red    = s->red;
+        child  = s->right;
+        parent = s->parent;
+        if (parent == n) {
+            parent = s;
+        } else {
+            if (child) child->parent = parent;
+            parent->left = child;
+            s->right = n->right;
+            n->right->parent = s;
+        }
+        s->left = n->left;
+        n->left->parent = s;
+        s->parent = n->parent;
+        s->red    = n->red;
+        replace_child(root, n->parent, n, s);
+    }
+
+    if (!red && root->node)
+        erase_fixup(root, child, parent);
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+    struct rb_node *n = root->node;
+    if (!n) return 0;
+    while (n->left) n = n->left;
+    return n;
+}
+
+struct rb_node *rb_next(const struct rb_node *n)
+{
+    if (n->right) {
+        n = n->right;
+        while (n->left) n = n->left;
+        return (struct rb_node *)n;
+    }
+    const struct rb_node *p;
+    while ((p = n->parent) && n == p->right)
+        n = p;
+    return (struct rb_node *)p;
+}
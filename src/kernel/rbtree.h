@@ -0,0 +1,35 @@
+#pragma once
+#include "types.h"
+
+/* Intrusive red-black tree.  Embed a struct rb_node in the object, link it
+   with rb_link_node() at the leaf found by the caller's own comparison walk,
+   then rebalance with rb_insert_color(). */
+
+struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    int red;
+};
+
+struct rb_root {
+    struct rb_node *node;
+};
+
+#define rb_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static inline void rb_link_node(struct rb_node *n, struct rb_node *parent,
+                                struct rb_node **link)
+{
+    n->parent = parent;
+    n->left = n->right = 0;
+    n->red = 1;
+    *link = n;
+}
+
+void rb_insert_color(struct rb_node *n, struct rb_root *root);
+void rb_erase(struct rb_node *n, struct rb_root *root);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *n);
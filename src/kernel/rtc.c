@@ -0,0 +1,66 @@
+#include "rtc.h"
+#include "x86.h"
+
+struct rtc_time {
+    u32 sec, min, hour, day, mon, year;
+};
+
+static u8 cmos_read(u8 reg)
+{
+    outb(CMOS_INDEX, reg);
+    return inb(CMOS_DATA);
+}
+
+static void rtc_snapshot(struct rtc_time *t)
+{
+    while (cmos_read(RTC_STATUS_A) & RTC_A_UPDATING)
+        ;
+    t->sec  = cmos_read(RTC_SECONDS);
+    t->min  = cmos_read(RTC_MINUTES);
+    t->hour = cmos_read(RTC_HOURS);
+    t->day  = cmos_read(RTC_DAY);
+    t->mon  = cmos_read(RTC_MONTH);
+    t->year = cmos_read(RTC_YEAR);
+}
+
+static u32 bcd(u32 v) { return (v & 0x0F) + (v >> 4) * 10; }
+
+/* Days from 1970-01-01 to y-m-d (proleptic Gregorian) */
+static u64 days_from_civil(u32 y, u32 m, u32 d)
+{
+    y -= m <= 2;
+    u32 era = y / 400;
+    u32 yoe = y - era * 400;
+    u32 doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    u32 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (u64)era * 146097 + doe - 719468;
+}
+
+u64 rtc_read_epoch(void)
+{
+    /* an update can land between the reads: take two identical snapshots */
+    struct rtc_time a, b;
+    rtc_snapshot(&b);
+    do {
+        a = b;
+        rtc_snapshot(&b);
+    } while (a.sec != b.sec || a.min != b.min || a.hour != b.hour ||
+             a.day != b.day || a.mon != b.mon || a.year != b.year);
+
+    u8 status = cmos_read(RTC_STATUS_B);
+    u32 pm = a.hour & RTC_HOUR_PM;
+    a.hour &= ~RTC_HOUR_PM;
+    if (!(status & RTC_B_BINARY)) {
+        a.sec  = bcd(a.sec);
+        a.min  = bcd(a.min);
+        a.hour = bcd(a.hour);
+        a.day  = bcd(a.day);
+        a.mon  = bcd(a.mon);
+        a.year = bcd(a.year);
+    }
+    if (!(status & RTC_B_24HOUR))
+        a.hour = a.hour % 12 + (pm ? 12 : 0);
+
+    u64 days = days_from_civil(2000 + a.year, a.mon, a.day);
+    return days * 86400 + a.hour * 3600 + a.min * 60 + a.sec;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "types.h"
+
+// CMOS real-time clock
+#define CMOS_INDEX   0x70   // register select (bit 7 masks NMI)
+#define CMOS_DATA    0x71
+
+#define RTC_SECONDS  0x00
+#define RTC_MINUTES  0x02
+#define RTC_HOURS    0x04
+#define RTC_DAY      0x07
+#define RTC_MONTH    0x08
+#define RTC_YEAR     0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+
+#define RTC_A_UPDATING 0x80  // an update cycle is in progress
+#define RTC_B_24HOUR   0x02
+#define RTC_B_BINARY   0x04  // values are binary, not BCD
+#define RTC_HOUR_PM    0x80  // in 12-hour mode
+
+// Wall-clock time as seconds since 1970-01-01 UTC (the RTC is assumed to
+// run in UTC, years 2000-2099).  Takes up to a second: call at boot.
+u64 rtc_read_epoch(void);
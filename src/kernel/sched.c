@@ -0,0 +1,1271 @@
+#include "sched.h"
+#include "apic.h"
+#include "clock.h"
+#include "devfs.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "mem.h"
+#include "panic.h"
+#include "print.h"
+#include "proc.h"
+#include "x86.h"
+
+static struct runq runqs[MAX_CPUS];
+static int idle_mwait;      // MONITOR/MWAIT usable: idle without needing IPIs
+
+/* isolcpus=: CPUs kept for tasks pinned there.  Nothing starts on them
+   (new tasks inherit the housekeeping mask), they neither steal nor are
+   stolen from, and nobody kicks them to go look for work. */
+static cpumask_t isolated_mask;
+static cpumask_t housekeeping_mask;
+
+/* Topology, built from struct cpu by sched_topology_init */
+static cpumask_t smt_mask[MAX_CPUS];    // CPUs on the same physical core
+static cpumask_t llc_mask[MAX_CPUS];    // CPUs sharing the last-level cache
+
+static void sched_tick(struct hrtimer *t);
+
+#define CPUID_1_ECX_MONITOR (1U << 3)
+
+/* Sleeping processes, hashed by channel */
+#define SLEEPQ_HASH 64
+struct sleepq {
+    struct spinlock lock;
+    struct proc *head;
+};
+static struct sleepq sleepqs[SLEEPQ_HASH];
+
+/* The worst wakeup latencies since tracing was turned on, worst first.
+   A wait below the current cutoff is rejected without the lock. */
+struct lat_trace_ent {
+    u64 lat_ns;
+    u64 at_ns;          // when the task finally ran
+    u32 pid;
+    u32 cpu;            // ran on
+    u32 waker_cpu;      // woken from
+    u32 policy;
+    char name[16];
+};
+
+static struct {
+    struct spinlock lock;
+    volatile int enabled;
+    u32 n;
+    struct lat_trace_ent ent[SCHED_TRACE_MAX];
+} lat_trace;
+
+struct runq *cpu_runq(u32 cpu_id) { return &runqs[cpu_id]; }
+
+void sched_init(void)
+{
+    for (int i = 0; i < MAX_CPUS; i++) {
+        initlock(&runqs[i].lock, "runq");
+        runqs[i].tasks.node = 0;
+        runqs[i].min_vruntime = 0;
+        for (int j = 0; j <= SCHED_RT_PRIO_MAX; j++)
+            list_init(&runqs[i].rt_queue[j]);
+        for (int j = 0; j < SCHED_RT_BITMAP_WORDS; j++)
+            runqs[i].rt_bitmap[j] = 0;
+        runqs[i].rt_nr_running = 0;
+        runqs[i].curr_rt_prio = 0;
+        runqs[i].rt_time = 0;
+        runqs[i].rt_period_start = 0;
+        runqs[i].rt_throttled = 0;
+        runqs[i].nr_rt_throttled = 0;
+        runqs[i].nr_running = 0;
+        runqs[i].need_resched = 0;
+        runqs[i].resched_at = 0;
+        runqs[i].resched_max_ns = 0;
+        runqs[i].resched_sum_ns = 0;
+        runqs[i].nr_resched = 0;
+        runqs[i].nr_switches = 0;
+        runqs[i].rq_len_sum = 0;
+        runqs[i].rq_len_max = 0;
+        memset(&runqs[i].wakeup_lat, 0, sizeof(runqs[i].wakeup_lat));
+        runqs[i].ticks = 0;
+        runqs[i].nr_migrations = 0;
+        runqs[i].nr_idle = 0;
+        runqs[i].idle_ns = 0;
+        runqs[i].nr_poll_wakes = 0;
+        runqs[i].nr_kicks = 0;
+        runqs[i].nr_kicks_coalesced = 0;
+        runqs[i].kick_pending = 0;
+        runqs[i].tick_armed = 0;
+        hrtimer_init(&runqs[i].tick_timer, sched_tick);
+        runqs[i].idle_poll = 0;
+    }
+    u32 ecx;
+    cpuid(1, 0, 0, 0, &ecx, 0);
+    idle_mwait = (ecx & CPUID_1_ECX_MONITOR) != 0;
+    for (int i = 0; i < SLEEPQ_HASH; i++) {
+        initlock(&sleepqs[i].lock, "sleepq");
+        sleepqs[i].head = 0;
+    }
+    initlock(&lat_trace.lock, "schedtrace");
+    cpumask_clear(&isolated_mask);
+    cpumask_setall(&housekeeping_mask);
+}
+
+static int cpu_isolated(u32 cpu) { return cpumask_test(&isolated_mask, cpu); }
+
+void sched_topology_init(void)
+{
+    u32 cores = 0, llcs = 0;
+    for (u32 i = 0; i < ncpu; i++) {
+        cpumask_clear(&smt_mask[i]);
+        cpumask_clear(&llc_mask[i]);
+        int first_core = 1, first_llc = 1;
+        for (u32 j = 0; j < ncpu; j++) {
+            if (cpus[j].core_id == cpus[i].core_id) {
+                cpumask_set(&smt_mask[i], j);
+                if (j < i) first_core = 0;
+            }
+            if (cpus[j].llc_id == cpus[i].llc_id) {
+                cpumask_set(&llc_mask[i], j);
+                if (j < i) first_llc = 0;
+            }
+        }
+        cores += first_core;
+        llcs  += first_llc;
+    }
+    klog_ok("SCHED", "%u CPU(s) on %u core(s), %u last-level cache(s)",
+            (u64)ncpu, (u64)cores, (u64)llcs);
+}
+
+/* Unlocked reads: a stale answer only costs a worse placement */
+static int cpu_is_idle(u32 cpu) { return !cpus[cpu].proc && !runqs[cpu].nr_running; }
+
+static int core_is_idle(u32 cpu)
+{
+    for (u32 i = 0; i < ncpu; i++)
+        if (cpumask_test(&smt_mask[cpu], i) && !cpu_is_idle(i)) return 0;
+    return 1;
+}
+
+static int cpus_share_llc(u32 a, u32 b) { return cpumask_test(&llc_mask[a], b); }
+
+u32 sched_housekeeping_cpu(u32 cpu)
+{
+    if (!cpu_isolated(cpu)) return cpu;
+    for (u32 i = 0; i < ncpu; i++)
+        if (!cpu_isolated(i) && cpus_share_llc(cpu, i)) return i;
+    return 0;
+}
+
+/* list: "2", "2-3,6" ...  CPU 0 takes the device interrupts and keeps
+   the clocksource from wrapping, so it always stays in general use. */
+void sched_isolate_cpus(const char *list)
+{
+    cpumask_t m;
+    cpumask_clear(&m);
+    const char *s = list;
+    while (*s >= '0' && *s <= '9') {
+        u32 lo = 0, hi;
+        while (*s >= '0' && *s <= '9') lo = lo * 10 + (u32)(*s++ - '0');
+        hi = lo;
+        if (*s == '-') {
+            s++;
+            hi = 0;
+            while (*s >= '0' && *s <= '9') hi = hi * 10 + (u32)(*s++ - '0');
+        }
+        for (u32 i = lo; i <= hi && i < ncpu; i++)
+            if (i != 0) cpumask_set(&m, i);
+        if (*s != ',') break;
+        s++;
+    }
+    isolated_mask = m;
+    cpumask_setall(&housekeeping_mask);
+    for (u32 i = 0; i < ncpu; i++)
+        if (cpu_isolated(i)) cpumask_unset(&housekeeping_mask, i);
+    for (u32 i = 0; i < ncpu; i++)
+        if (cpu_isolated(i)) timer_migrate(i);
+    klog_ok("SCHED", "isolated cpus mask %x", isolated_mask.bits[0]);
+}
+
+/* ---- fair-share accounting (caller holds rq->lock) ---- */
+
+/* Linux's nice-to-weight table: each nice step is ~10% CPU */
+static const u32 nice_weight[40] = {
+ /* -20 */ 88761, 71755, 56483, 46273, 36291,
+ /* -15 */ 29154, 23254, 18705, 14949, 11916,
+ /* -10 */  9548,  7620,  6100,  4904,  3906,
+ /*  -5 */  3121,  2501,  1991,  1586,  1277,
+ /*   0 */  1024,   820,   655,   526,   423,
+ /*   5 */   335,   272,   215,   172,   137,
+ /*  10 */   110,    87,    70,    56,    45,
+ /*  15 */    36,    29,    23,    18,    15,
+};
+
+static u64 sched_clock(void) { return tsc_to_ns(rdtsc()); }
+
+/* ---- latency statistics ---- */
+
+static void lat_hist_add(struct lat_hist *h, u64 ns)
+{
+    u64 us = ns / 1000;
+    u32 b = us ? 64 - (u32)__builtin_clzll(us) : 0;
+    if (b >= SCHED_LAT_BUCKETS) b = SCHED_LAT_BUCKETS - 1;
+    h->count[b]++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+
+static void lat_trace_add(struct proc *p, u32 cpu, u64 lat, u64 now)
+{
+    if (!lat_trace.enabled) return;
+    if (lat_trace.n == SCHED_TRACE_MAX && lat <= lat_trace.ent[SCHED_TRACE_MAX - 1].lat_ns)
+        return;
+    acquire(&lat_trace.lock);
+    u32 i = lat_trace.n;
+    int keep = i < SCHED_TRACE_MAX || lat > lat_trace.ent[i - 1].lat_ns;
+    if (keep) {
+        if (i < SCHED_TRACE_MAX) lat_trace.n++;
+        else i--;               /* the least of them drops out */
+        for (; i > 0 && lat_trace.ent[i - 1].lat_ns < lat; i--)
+            lat_trace.ent[i] = lat_trace.ent[i - 1];
+        struct lat_trace_ent *e = &lat_trace.ent[i];
+        e->lat_ns    = lat;
+        e->at_ns     = now;
+        e->pid       = p->pid;
+        e->cpu       = cpu;
+        e->waker_cpu = p->waker_cpu;
+        e->policy    = p->policy;
+        memcpy(e->name, p->name, sizeof(e->name));
+    }
+    release(&lat_trace.lock);
+}
+
+/* wall ns -> vruntime ns at p's weight */
+static u64 calc_delta(u64 delta, struct proc *p)
+{
+    if (p->weight == NICE_0_WEIGHT) return delta;
+    return delta * NICE_0_WEIGHT / p->weight;
+}
+
+static int vruntime_before(u64 a, u64 b) { return (i64)(a - b) < 0; }
+
+static struct proc *runq_first(struct runq *rq)
+{
+    struct rb_node *n = rb_first(&rq->tasks);
+    return n ? rb_entry(n, struct proc, rq_node) : 0;
+}
+
+static void update_min_vruntime(struct runq *rq, struct proc *curr)
+{
+    struct proc *left = runq_first(rq);
+    u64 vr = rq->min_vruntime;
+    if (curr) vr = curr->vruntime;
+    if (left && (!curr || vruntime_before(left->vruntime, vr)))
+        vr = left->vruntime;
+    if (vruntime_before(rq->min_vruntime, vr))
+        rq->min_vruntime = vr;
+}
+
+static int rt_task(struct proc *p) { return p->policy != SCHED_NORMAL; }
+
+/* ---- real-time class (caller holds rq->lock) ---- */
+
+/* Highest priority with a queued task, 0 if none: one word test per 64
+   levels, so O(1) in the number of tasks */
+static u32 rt_top_prio(struct runq *rq)
+{
+    for (int w = SCHED_RT_BITMAP_WORDS - 1; w >= 0; w--)
+        if (rq->rt_bitmap[w])
+            return (u32)w * 64 + 63 - (u32)__builtin_clzll(rq->rt_bitmap[w]);
+    return 0;
+}
+
+static struct proc *rt_first(struct runq *rq)
+{
+    u32 prio = rt_top_prio(rq);
+    if (!prio) return 0;
+    return list_entry(rq->rt_queue[prio].next, struct proc, rt_link);
+}
+
+/* Woken and round-robin tasks go to the back of their level; a preempted
+   one keeps its place at the front */
+static void rt_insert(struct runq *rq, struct proc *p, int head)
+{
+    struct list_head *q = &rq->rt_queue[p->rt_priority];
+    if (head) {
+        p->rt_link.next = q->next;
+        p->rt_link.prev = q;
+        q->next->prev = &p->rt_link;
+        q->next = &p->rt_link;
+    } else {
+        list_add_tail(&p->rt_link, q);
+    }
+    rq->rt_bitmap[p->rt_priority / 64] |= 1UL << (p->rt_priority % 64);
+    rq->rt_nr_running++;
+}
+
+static void rt_remove(struct runq *rq, struct proc *p)
+{
+    list_del(&p->rt_link);
+    if (list_empty(&rq->rt_queue[p->rt_priority]))
+        rq->rt_bitmap[p->rt_priority / 64] &= ~(1UL << (p->rt_priority % 64));
+    rq->rt_nr_running--;
+}
+
+/* The budget is per period of wall time, counted only while real-time
+   tasks run; a new period lifts the throttle */
+static void rt_period_update(struct runq *rq, u64 now)
+{
+    if (now - rq->rt_period_start < SCHED_RT_PERIOD_NS) return;
+    rq->rt_period_start = now;
+    rq->rt_time = 0;
+    rq->rt_throttled = 0;
+}
+
+// Fair tasks are waiting behind throttled real-time ones
+static int rt_yield_to_fair(struct runq *rq)
+{
+    return rq->rt_throttled && rq->nr_running > rq->rt_nr_running;
+}
+
+/* Charge the running task for the time since exec_start */
+static void update_curr(struct runq *rq, struct proc *curr)
+{
+    u64 now = sched_clock();
+    u64 delta = now - curr->exec_start;
+    curr->exec_start = now;
+    curr->sum_exec  += delta;
+    rt_period_update(rq, now);
+    if (rt_task(curr)) {
+        rq->rt_time += delta;
+        if (!rq->rt_throttled && rq->rt_time >= SCHED_RT_RUNTIME_NS) {
+            rq->rt_throttled = 1;
+            rq->nr_rt_throttled++;
+        }
+        if (curr->policy == SCHED_RR)
+            curr->rt_slice = curr->rt_slice > delta ? curr->rt_slice - delta : 0;
+        return;
+    }
+    curr->vruntime  += calc_delta(delta, curr);
+    update_min_vruntime(rq, curr);
+}
+
+/* Queue p in its class.  A real-time task goes to the back of its level
+   unless head (preempted with slice left); an exhausted RR slice is
+   refilled here. */
+static void runq_insert_rt(struct runq *rq, struct proc *p, int head)
+{
+    if (!p->rt_slice) p->rt_slice = SCHED_RR_SLICE_NS;
+    rt_insert(rq, p, head);
+    p->wait_start = sched_clock();
+    p->on_rq = 1;
+    rq->nr_running++;
+}
+
+static void runq_insert(struct runq *rq, struct proc *p)
+{
+    if (rt_task(p)) {
+        runq_insert_rt(rq, p, 0);
+        return;
+    }
+    struct rb_node **link = &rq->tasks.node, *parent = 0;
+    while (*link) {
+        parent = *link;
+        struct proc *q = rb_entry(parent, struct proc, rq_node);
+        /* equal keys go right: FIFO among ties */
+        link = vruntime_before(p->vruntime, q->vruntime) ? &parent->left
+                                                         : &parent->right;
+    }
+    rb_link_node(&p->rq_node, parent, link);
+    rb_insert_color(&p->rq_node, &rq->tasks);
+    p->wait_start = sched_clock();
+    p->on_rq = 1;
+    rq->nr_running++;
+}
+
+static void runq_remove(struct runq *rq, struct proc *p)
+{
+    if (rt_task(p)) rt_remove(rq, p);
+    else            rb_erase(&p->rq_node, &rq->tasks);
+    p->on_rq = 0;
+    rq->nr_running--;
+}
+
+/* Real-time first, by priority, unless throttled while fair tasks wait */
+static struct proc *pick_next(struct runq *rq)
+{
+    rt_period_update(rq, sched_clock());
+    if (rq->rt_nr_running && !rt_yield_to_fair(rq))
+        return rt_first(rq);
+    return runq_first(rq);
+}
+
+/* Should the newly queued p preempt curr? */
+static int wakeup_preempt(struct runq *rq, struct proc *curr, struct proc *p)
+{
+    if (rt_task(p)) {
+        if (rt_task(curr)) return p->rt_priority > curr->rt_priority;
+        return !rq->rt_throttled;
+    }
+    if (rt_task(curr)) return rq->rt_throttled;
+    return vruntime_before(p->vruntime + SCHED_WAKEUP_GRAN_NS, curr->vruntime);
+}
+
+/* p is about to run: close its wait period, open an exec period (which
+   resumes in the kernel, so it also restarts system time accounting) */
+static void set_next(struct runq *rq, struct proc *p)
+{
+    u64 now = sched_clock();
+    p->wait_sum  += now - p->wait_start;
+    p->exec_start = now;
+    p->acct_ts    = now;
+    if (p->wakeup_ts) {
+        u64 lat = now - p->wakeup_ts;
+        lat_hist_add(&p->wakeup_lat, lat);
+        lat_hist_add(&rq->wakeup_lat, lat);
+        lat_trace_add(p, p->cpu, lat, now);
+        p->wakeup_ts = 0;
+    }
+}
+
+/* Keep vruntime relative to the queue the task moves to */
+static void migrate_vruntime(struct proc *p, struct runq *src, struct runq *dst)
+{
+    p->vruntime = p->vruntime - src->min_vruntime + dst->min_vruntime;
+}
+
+/* p->cpu is written only under that run queue's lock, and under both
+   queues' when p moves, so it cannot change while either is held.  Lock
+   the queue p is on, retrying if p moved before we got it. */
+static struct runq *task_rq_lock(struct proc *p)
+{
+    for (;;) {
+        u32 cpu = __atomic_load_n(&p->cpu, __ATOMIC_RELAXED);
+        struct runq *rq = &runqs[cpu];
+        acquire(&rq->lock);
+        if (p->cpu == cpu) return rq;
+        release(&rq->lock);
+    }
+}
+
+/* Two run queues at once: lower cpu_id first */
+static void double_rq_lock(struct runq *a, struct runq *b)
+{
+    if (a > b) { struct runq *t = a; a = b; b = t; }
+    acquire(&a->lock);
+    acquire(&b->lock);
+}
+
+static void double_rq_unlock(struct runq *a, struct runq *b)
+{
+    if (a < b) { struct runq *t = a; a = b; b = t; }
+    release(&a->lock);
+    release(&b->lock);
+}
+
+void sched_fork(struct proc *p, struct proc *parent)
+{
+    if (parent) p->cpus_allowed = parent->cpus_allowed;
+    else        p->cpus_allowed = housekeeping_mask;
+    p->nice       = parent ? parent->nice : 0;
+    p->weight     = nice_weight[p->nice - NICE_MIN];
+    p->policy     = parent ? parent->policy : SCHED_NORMAL;
+    p->rt_priority = parent ? parent->rt_priority : 0;
+    p->rt_slice   = 0;
+    p->on_rq      = 0;
+    p->yielded    = 0;
+    list_init(&p->rt_link);
+    p->vruntime   = 0;
+    p->sum_exec   = 0;
+    p->wait_sum   = 0;
+    p->exec_start = 0;
+    p->wait_start = 0;
+    p->wakeup_ts  = 0;
+    memset(&p->wakeup_lat, 0, sizeof(p->wakeup_lat));
+}
+
+void sched_set_nice(struct proc *p, i32 nice)
+{
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    struct runq *rq = task_rq_lock(p);
+    /* time run so far is charged at the old weight */
+    if (cpus[p->cpu].proc == p) update_curr(rq, p);
+    p->nice   = nice;
+    p->weight = nice_weight[nice - NICE_MIN];
+    release(&rq->lock);
+}
+
+/* ---- preemption (caller holds rq->lock) ---- */
+
+/* Ask the CPU's current task to give way at its next safe point: the
+   return from an interrupt that found interrupts on, or a cond_resched. */
+static void resched_curr(struct runq *rq)
+{
+    if (!rq->need_resched) rq->resched_at = rdtsc();
+    rq->need_resched = 1;
+}
+
+/* The task gave way (or nobody is left to take over): account the wait */
+static void resched_done(struct runq *rq)
+{
+    if (rq->need_resched) {
+        u64 ns = tsc_to_ns(rdtsc() - rq->resched_at);
+        if (ns > rq->resched_max_ns) rq->resched_max_ns = ns;
+        rq->resched_sum_ns += ns;
+        rq->nr_resched++;
+    }
+    rq->need_resched = 0;
+}
+
+/* ---- tick control (caller holds rq->lock on the owning CPU) ---- */
+
+static void tick_arm(struct runq *rq, u64 ns)
+{
+    hrtimer_start(&rq->tick_timer, clock_monotonic_ns() + ns);
+    rq->tick_armed = 1;
+}
+
+static void tick_disarm(struct runq *rq)
+{
+    hrtimer_cancel(&rq->tick_timer);
+    rq->tick_armed = 0;
+}
+
+/* A CPU idling in mwait is watching its idle_poll word: clearing it is
+   the wakeup, and no IPI is needed.  Otherwise one IPI in flight is
+   enough: the handler clears kick_pending before it looks at the queue,
+   so whatever was queued before it ran is seen. */
+static void kick_cpu(u32 cpu)
+{
+    struct runq *rq = &runqs[cpu];
+    if (__atomic_exchange_n(&rq->idle_poll, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&rq->nr_poll_wakes, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (__atomic_exchange_n(&rq->kick_pending, 1, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&rq->nr_kicks_coalesced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&rq->nr_kicks, 1, __ATOMIC_RELAXED);
+    lapic_send_ipi(cpus[cpu].apic_id, IPI_KICK);
+}
+
+/* Wait, interrupts off, for work to be queued here.  idle_poll is set
+   before the monitor is armed and tested after: a kick_cpu that clears it
+   in between makes us skip the mwait, one that finds it clear sends the
+   IPI, which the sti shadow holds until we are waiting.  Residency counts
+   from the halt to the end of the interrupt that ended it. */
+static void cpu_idle(struct runq *rq)
+{
+    u64 t0 = rdtsc();
+    rq->nr_idle++;
+    if (idle_mwait) {
+        __atomic_store_n(&rq->idle_poll, 1, __ATOMIC_SEQ_CST);
+        monitor(&rq->idle_poll);
+        if (rq->idle_poll && !rq->nr_running)
+            sti_mwait(SCHED_IDLE_MWAIT_HINT);
+        else
+            sti();
+        rq->idle_poll = 0;
+    } else {
+        sti_hlt();
+    }
+    rq->idle_ns += tsc_to_ns(rdtsc() - t0);
+}
+
+/* ---- placement ---- */
+
+/* New processes go to the allowed CPU with the shortest queue, preferring
+   this one on a tie and, among idle CPUs, one whose SMT siblings are idle
+   too.  nr_running is read without the locks: a stale value only costs a
+   slightly worse choice. */
+u32 sched_select_cpu(const cpumask_t *allowed)
+{
+    u32 self = mycpu()->cpu_id;
+    i32 best = -1;
+    u32 best_key = 0;
+    if (cpumask_test(allowed, self)) {
+        best = (i32)self;
+        best_key = runqs[self].nr_running * 2;
+    }
+    for (u32 i = 0; i < ncpu; i++) {
+        if (!cpumask_test(allowed, i)) continue;
+        u32 nr = runqs[i].nr_running + (cpus[i].proc ? 1 : 0);
+        u32 key = nr * 2 + (nr == 0 && !core_is_idle(i));
+        if (best < 0 || key < best_key) { best = (i32)i; best_key = key; }
+    }
+    return best < 0 ? self : (u32)best;
+}
+
+/* An idle CPU sharing target's last-level cache, on an idle core if there
+   is one; target itself wins ties.  -1 if none is idle. */
+static i32 select_idle_sibling(struct proc *p, u32 target)
+{
+    i32 idle = -1;
+    for (u32 i = 0; i < ncpu; i++) {
+        if (!cpumask_test(&llc_mask[target], i) || !cpumask_test(&p->cpus_allowed, i) ||
+            (cpu_isolated(i) && i != target) || !cpu_is_idle(i))
+            continue;
+        if (core_is_idle(i)) return (i32)i;
+        if (idle < 0 || i == target) idle = (i32)i;
+    }
+    return idle;
+}
+
+/* A woken task stays by the cache it last used, unless a task woke it
+   from a CPU that shares none: then it follows the waker (a pipe's reader
+   ends up next to its writer).  Within that cache it takes an idle core,
+   else an idle sibling, else it queues where it last ran.  One woken
+   while still switching out there stays: another CPU would only spin on
+   its on_cpu, and its cache is warmest where it is. */
+static u32 select_wake_cpu(struct proc *p)
+{
+    struct cpu *c = mycpu();
+    u32 prev = p->cpu, waker = c->cpu_id, target = prev;
+    if (__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE) &&
+        cpumask_test(&p->cpus_allowed, prev))
+        return prev;
+    if (c->proc && c->preempt_count < PREEMPT_IRQ && !cpus_share_llc(prev, waker) &&
+        cpumask_test(&p->cpus_allowed, waker) && !cpu_isolated(waker))
+        target = waker;
+    if (cpumask_test(&p->cpus_allowed, target) && cpu_is_idle(target) && core_is_idle(target))
+        return target;
+    i32 idle = select_idle_sibling(p, target);
+    if (idle >= 0) return (u32)idle;
+    return cpumask_test(&p->cpus_allowed, prev) ? prev : sched_select_cpu(&p->cpus_allowed);
+}
+
+/* A real-time task that would wait behind an equal or more urgent one
+   goes to the allowed CPU running the least urgent work, idle ones
+   first.  curr_rt_prio is read unlocked: stale, it costs a worse choice. */
+static u32 select_rt_cpu(struct proc *p)
+{
+    u32 cpu = p->cpu;
+    if (cpumask_test(&p->cpus_allowed, cpu) && runqs[cpu].curr_rt_prio < p->rt_priority)
+        return cpu;
+    i32 best = -1;
+    u32 best_prio = 0;
+    int best_idle = 0;
+    for (u32 i = 0; i < ncpu; i++) {
+        if (!cpumask_test(&p->cpus_allowed, i)) continue;
+        u32 prio = runqs[i].curr_rt_prio;
+        int idle = !cpus[i].proc;
+        if (best < 0 || prio < best_prio || (prio == best_prio && idle && !best_idle)) {
+            best = (i32)i;
+            best_prio = prio;
+            best_idle = idle;
+        }
+    }
+    return best < 0 ? sched_select_cpu(&p->cpus_allowed) : (u32)best;
+}
+
+/* Placement: a woken task goes where select_wake_cpu says.  A new task
+   starts one slice behind the queue so forking cannot starve the others;
+   a sleeper keeps its vruntime but at most
+   SCHED_SLEEPER_CREDIT_NS below min_vruntime, and preempts the current
+   task if it is SCHED_WAKEUP_GRAN_NS behind it.
+
+   The target must notice the new task: an idle CPU sits in hlt and a CPU
+   running a lone task has no tick.  Our own timer we arm directly (at once
+   to preempt), a remote one is kicked.  cpus[].proc is only cleared under
+   the rq lock.  Real-time tasks are placed by select_rt_cpu and preempt
+   anything less urgent.
+
+   p is on no queue and only we move it, so p->cpu may be read unlocked;
+   moving it takes both queues' locks for task_rq_lock's sake. */
+void sched_enqueue(struct proc *p, int flags)
+{
+    u32 from = p->cpu, cpu = from;
+    if (rt_task(p))
+        cpu = select_rt_cpu(p);
+    else if (flags == ENQUEUE_WAKEUP)
+        cpu = select_wake_cpu(p);
+    else if (!cpumask_test(&p->cpus_allowed, from))
+        cpu = sched_select_cpu(&p->cpus_allowed);  /* the affinity changed before it first ran */
+    struct runq *rq = &runqs[cpu];
+    int kick = 0;
+    if (cpu != from) {
+        double_rq_lock(&runqs[from], rq);
+        if (!rt_task(p) && flags == ENQUEUE_WAKEUP)
+            migrate_vruntime(p, &runqs[from], rq);
+        p->cpu = cpu;
+        release(&runqs[from].lock);
+    } else {
+        acquire(&rq->lock);
+    }
+    struct proc *curr = cpus[cpu].proc;
+    if (curr) update_curr(rq, curr);
+
+    if (rt_task(p)) {
+        if (curr && wakeup_preempt(rq, curr, p)) resched_curr(rq);
+    } else if (flags == ENQUEUE_NEW) {
+        p->vruntime = rq->min_vruntime + calc_delta(SCHED_SLICE_NS, p);
+    } else {
+        u64 floor = rq->min_vruntime - SCHED_SLEEPER_CREDIT_NS;
+        if (vruntime_before(p->vruntime, floor)) p->vruntime = floor;
+        if (curr && wakeup_preempt(rq, curr, p))
+            resched_curr(rq);
+    }
+    p->state = PROC_RUNNABLE;
+    runq_insert(rq, p);
+
+    if (cpu != mycpu()->cpu_id) {
+        kick = !curr || !rq->tick_armed || rq->need_resched;
+    } else if (curr && rq->need_resched) {
+        tick_arm(rq, 0);
+    } else if (curr && !rq->tick_armed) {
+        tick_arm(rq, SCHED_SLICE_NS);
+    }
+    release(&rq->lock);
+    if (kick) kick_cpu(cpu);
+}
+
+/* Readers test the mask without the lock; a stale bit only costs one more
+   pass through sched_enqueue's re-placement.  A task left on a CPU it may
+   no longer use is moved when that CPU next schedules: at once if it is
+   running there, otherwise when it reaches the front of the queue. */
+void sched_set_affinity(struct proc *p, const cpumask_t *mask)
+{
+    struct runq *rq = task_rq_lock(p);
+    u32 cpu = p->cpu;
+    p->cpus_allowed = *mask;
+    int running = cpus[cpu].proc == p;
+    int move = !cpumask_test(mask, cpu);
+    if (move && running) resched_curr(rq);
+    release(&rq->lock);
+    if (!move || !running) return;
+    if (p == current_proc) yield();
+    else kick_cpu(cpu);
+}
+
+/* A queued task is moved between classes; a running one is charged under
+   the old policy first and rescheduled if it no longer comes first.  When
+   p is the caller it may yield here, so no other lock may be held. */
+int sched_set_policy(struct proc *p, u32 policy, u32 prio)
+{
+    if (policy == SCHED_NORMAL ? prio != 0
+        : (policy != SCHED_FIFO && policy != SCHED_RR) ||
+          prio < SCHED_RT_PRIO_MIN || prio > SCHED_RT_PRIO_MAX)
+        return -1;
+    struct runq *rq = task_rq_lock(p);
+    u32 cpu = p->cpu;
+    int running = cpus[cpu].proc == p;
+    int queued  = p->on_rq;
+    if (running) update_curr(rq, p);
+    if (queued) runq_remove(rq, p);
+    if (rt_task(p) && policy == SCHED_NORMAL)
+        p->vruntime = rq->min_vruntime;     /* rejoin the fair queue level */
+    p->policy      = policy;
+    p->rt_priority = prio;
+    p->rt_slice    = 0;
+    if (queued) runq_insert(rq, p);
+
+    struct proc *curr = cpus[cpu].proc;
+    int resched = 0;
+    if (running) {
+        rq->curr_rt_prio = prio;
+        struct proc *next = pick_next(rq);
+        resched = next && wakeup_preempt(rq, p, next);
+    } else if (queued && curr) {
+        resched = wakeup_preempt(rq, curr, p);
+    }
+    if (resched) {
+        resched_curr(rq);
+        if (cpu == mycpu()->cpu_id && p != current_proc) {
+            tick_arm(rq, 0);        /* preempt ourselves once we can */
+        }
+    }
+    release(&rq->lock);
+    if (!resched) return 0;
+    if (p == current_proc) yield();
+    else if (cpu != mycpu()->cpu_id) kick_cpu(cpu);
+    return 0;
+}
+
+/* ---- load balancing ---- */
+
+static u32 cpu_load(u32 cpu)
+{
+    return runqs[cpu].nr_running + (cpus[cpu].proc ? 1 : 0);
+}
+
+/* CPU with the most queued (waiting) tasks other than `self`, or -1.
+   Moving within a last-level cache is cheap, so a CPU sharing ours wins
+   unless a remote one has at least two more.  Isolated CPUs take no part. */
+static i32 find_busiest(u32 self)
+{
+    i32 busiest = -1, near = -1;
+    u32 max = 0, near_max = 0;
+    if (cpu_isolated(self)) return -1;
+    for (u32 i = 0; i < ncpu; i++) {
+        if (i == self || cpu_isolated(i)) continue;
+        u32 nr = runqs[i].nr_running;
+        if (nr > max) { max = nr; busiest = (i32)i; }
+        if (cpus_share_llc(self, i) && nr > near_max) { near_max = nr; near = (i32)i; }
+    }
+    return near >= 0 && near_max + 1 >= max ? near : busiest;
+}
+
+static int task_cache_hot(struct proc *p, u64 now)
+{
+    return now - p->last_ran < SCHED_CACHE_HOT_CYCLES;
+}
+
+/* Pick a task to migrate off src to dst (caller holds src->lock).  The
+   most deserving (lowest vruntime) cold task allowed on dst wins; a hot one
+   only goes if `force` and src has a backlog, since it would otherwise wait
+   out the cache benefit anyway.  Only `force` (an idle dst) moves
+   real-time tasks. */
+static struct proc *detach_task(struct runq *src, u32 dst, int force)
+{
+    u64 now = rdtsc();
+    struct proc *hot = 0;
+    /* an idle CPU takes waiting real-time work first, hot or not */
+    if (force && src->rt_nr_running) {
+        for (u32 prio = SCHED_RT_PRIO_MAX; prio >= SCHED_RT_PRIO_MIN; prio--) {
+            list_for_each(n, &src->rt_queue[prio]) {
+                struct proc *p = list_entry(n, struct proc, rt_link);
+                if (!cpumask_test(&p->cpus_allowed, dst)) continue;
+                runq_remove(src, p);
+                return p;
+            }
+        }
+    }
+    for (struct rb_node *n = rb_first(&src->tasks); n; n = rb_next(n)) {
+        struct proc *p = rb_entry(n, struct proc, rq_node);
+        if (!cpumask_test(&p->cpus_allowed, dst)) continue;
+        if (!task_cache_hot(p, now)) {
+            runq_remove(src, p);
+            return p;
+        }
+        if (!hot) hot = p;
+    }
+    if (force && hot && src->nr_running > 1) {
+        runq_remove(src, hot);
+        return hot;
+    }
+    return 0;
+}
+
+/* Idle CPU: take one waiting task from the busiest queue.  The task is
+   returned detached; the caller runs it straight away. */
+static struct proc *steal_task(u32 self)
+{
+    i32 busiest = find_busiest(self);
+    if (busiest < 0) return 0;
+
+    struct runq *src = &runqs[busiest], *dst = &runqs[self];
+    double_rq_lock(src, dst);
+    struct proc *p = detach_task(src, self, 1);
+    if (p) {
+        migrate_vruntime(p, src, dst);
+        p->cpu = self;
+        dst->nr_migrations++;
+    }
+    double_rq_unlock(src, dst);
+    return p;
+}
+
+/* Periodic pass from the tick: pull one task if the busiest CPU carries at
+   least two more tasks than we do. */
+static void balance_pull(u32 self)
+{
+    i32 busiest = find_busiest(self);
+    if (busiest < 0) return;
+    if (cpu_load((u32)busiest) < cpu_load(self) + 2) return;
+
+    struct runq *src = &runqs[busiest], *dst = &runqs[self];
+    double_rq_lock(src, dst);
+    struct proc *p = detach_task(src, self, 0);
+    if (p) {
+        migrate_vruntime(p, src, dst);
+        p->cpu = self;
+        runq_insert(dst, p);
+        dst->nr_migrations++;
+    }
+    double_rq_unlock(src, dst);
+}
+
+/* Tasks are waiting here: wake one halted CPU so it can steal */
+static void kick_idle_cpu(u32 self)
+{
+    if (cpu_isolated(self)) return;     /* nobody may steal from us */
+    /* one sharing our cache first, then one whose whole core is idle */
+    i32 best = -1;
+    u32 best_score = 0;
+    for (u32 i = 0; i < ncpu; i++) {
+        if (i == self || cpu_isolated(i) || !cpu_is_idle(i)) continue;
+        u32 score = 1 + (cpus_share_llc(self, i) ? 2 : 0) + (core_is_idle(i) ? 1 : 0);
+        if (score > best_score) { best = (i32)i; best_score = score; }
+    }
+    if (best >= 0) kick_cpu((u32)best);
+}
+
+/* A real-time task keeps the CPU until something more urgent is queued,
+   its budget runs out with fair tasks waiting, or (RR) its slice ends
+   with another task at its level.  A fair task is preempted by any
+   unthrottled real-time one, or when the leftmost queued task has fallen
+   behind it. */
+static int tick_preempt(struct runq *rq, struct proc *curr)
+{
+    struct proc *rt = rt_first(rq);
+    if (rt_task(curr)) {
+        if (rt_yield_to_fair(rq)) return 1;
+        if (rt && rt->rt_priority > curr->rt_priority) return 1;
+        if (curr->policy == SCHED_RR && !curr->rt_slice) {
+            if (rt && rt->rt_priority == curr->rt_priority) return 1;
+            curr->rt_slice = SCHED_RR_SLICE_NS;     /* alone at its level */
+        }
+        return 0;
+    }
+    if (rt && !rq->rt_throttled) return 1;
+    struct proc *left = runq_first(rq);
+    return left && vruntime_before(left->vruntime, curr->vruntime);
+}
+
+/* tick_timer: preempt or grant another slice */
+static void sched_tick(struct hrtimer *t)
+{
+    struct cpu *c = mycpu();
+    struct runq *rq = timer_entry(t, struct runq, tick_timer);     /* ours */
+    struct proc *curr = c->proc;
+    acquire(&rq->lock);
+    rq->tick_armed = 0;     /* one-shot: it just fired */
+    rq->ticks++;
+    int resched = rq->need_resched;
+    if (curr && !resched) {
+        update_curr(rq, curr);
+        resched = tick_preempt(rq, curr);
+        if (resched)
+            resched_curr(rq);
+        else if (rq->nr_running)
+            tick_arm(rq, SCHED_SLICE_NS);
+    }
+    release(&rq->lock);
+    if (rq->ticks % SCHED_BALANCE_TICKS == 0)
+        balance_pull(c->cpu_id);
+    if (rq->nr_running)
+        kick_idle_cpu(c->cpu_id);
+}
+
+void sched_kick(void)
+{
+    struct cpu *c = mycpu();
+    struct runq *rq = &runqs[c->cpu_id];
+    __atomic_store_n(&rq->kick_pending, 0, __ATOMIC_SEQ_CST);
+    acquire(&rq->lock);
+    if (c->proc && rq->nr_running && !rq->tick_armed && !rq->need_resched)
+        tick_arm(rq, SCHED_SLICE_NS);
+    release(&rq->lock);
+}
+
+/* ---- /dev/sched, /dev/schedtrace ---- */
+
+u64 lat_hist_format(char *buf, u64 cap, const struct lat_hist *h)
+{
+    u64 n = 0;
+    for (u32 b = 0; b < SCHED_LAT_BUCKETS; b++) n += h->count[b];
+    u64 len = ksnprintf(buf, cap, "n=%u avg_us=%u max_us=%u |", n,
+                        n ? h->sum_ns / n / 1000 : 0, h->max_ns / 1000);
+    for (u32 b = 0; b < SCHED_LAT_BUCKETS; b++)
+        len += ksnprintf(buf + len, cap - len, " %u", (u64)h->count[b]);
+    return len;
+}
+
+/* rq_avg is the number of tasks left waiting, averaged over switches.
+   Histogram buckets are log2 microseconds: <1 1 2 4 ... 262144+ */
+#define SCHED_DEV_CPU_MAX 640
+static i64 sched_dev_read(struct vfs_file *f, void *buf, u64 count, vfs_off_t *off)
+{
+    (void)f;
+    u64 pages = (u64)ncpu * SCHED_DEV_CPU_MAX / PAGE_SIZE + 1;
+    char *tmp = kalloc(pages);
+    if (!tmp) return VFS_ENOMEM;
+    u64 cap = pages * PAGE_SIZE;
+    u64 len = ksnprintf(tmp, cap,
+                        "timer lapic_hz=%u tsc_khz=%u mode=%s slice_us=%u idle=%s "
+                        "isolated=%x\n",
+                        lapic_timer_hz, tsc_khz,
+                        lapic_tsc_deadline ? "tsc-deadline" : "one-shot",
+                        SCHED_SLICE_NS / 1000, idle_mwait ? "mwait" : "hlt",
+                        isolated_mask.bits[0]);
+    for (u32 i = 0; i < ncpu; i++) {
+        struct runq *rq = &runqs[i];
+        u64 rq_avg = rq->nr_switches ? rq->rq_len_sum * 100 / rq->nr_switches : 0;
+        len += ksnprintf(tmp + len, cap - len,
+                         "cpu%u core=%u llc=%u nr_running=%u ticks=%u migrations=%u idle=%u "
+                         "idle_ms=%u poll_wakes=%u kicks=%u coalesced=%u "
+                         "rt_running=%u rt_throttled=%u resched_max_us=%u "
+                         "resched_avg_us=%u switches=%u rq_avg=%u.%02u rq_max=%u\n",
+                         (u64)i, (u64)cpus[i].core_id, (u64)cpus[i].llc_id,
+                         (u64)rq->nr_running, rq->ticks,
+                         rq->nr_migrations, rq->nr_idle,
+                         rq->idle_ns / 1000000, rq->nr_poll_wakes,
+                         rq->nr_kicks, rq->nr_kicks_coalesced,
+                         (u64)rq->rt_nr_running, rq->nr_rt_throttled,
+                         rq->resched_max_ns / 1000,
+                         rq->nr_resched ? rq->resched_sum_ns / rq->nr_resched / 1000 : 0,
+                         rq->nr_switches, rq_avg / 100, rq_avg % 100,
+                         (u64)rq->rq_len_max);
+        len += ksnprintf(tmp + len, cap - len, "cpu%u wakeup ", (u64)i);
+        len += lat_hist_format(tmp + len, cap - len, &rq->wakeup_lat);
+        len += ksnprintf(tmp + len, cap - len, "\n");
+    }
+    i64 n = devfs_read_text(tmp, len, buf, count, off);
+    kfree(tmp, pages);
+    return n;
+}
+
+static const struct vfs_file_ops sched_dev_fops = {
+    .read = sched_dev_read,
+};
+
+static const char *const policy_names[] = {
+    [SCHED_NORMAL] = "normal",
+    [SCHED_FIFO]   = "fifo",
+    [SCHED_RR]     = "rr",
+};
+
+const char *sched_policy_name(u32 policy) { return policy_names[policy]; }
+
+/* AT is monotonic ms when the task finally ran */
+static i64 schedtrace_read(struct vfs_file *f, void *buf, u64 count, vfs_off_t *off)
+{
+    (void)f;
+    char *tmp = kalloc(1);
+    if (!tmp) return VFS_ENOMEM;
+    u64 len = ksnprintf(tmp, PAGE_SIZE, "tracing=%s\n"
+                        "LAT_US     AT_MS      PID  CPU WAKER POL    NAME\n",
+                        lat_trace.enabled ? "on" : "off");
+    acquire(&lat_trace.lock);
+    for (u32 i = 0; i < lat_trace.n; i++) {
+        const struct lat_trace_ent *e = &lat_trace.ent[i];
+        len += ksnprintf(tmp + len, PAGE_SIZE - len,
+                         "%-10u %-10u %-4u %-3u %-5u %-6s %s\n",
+                         e->lat_ns / 1000, e->at_ns / 1000000, (u64)e->pid,
+                         (u64)e->cpu, (u64)e->waker_cpu,
+                         sched_policy_name(e->policy), e->name);
+    }
+    release(&lat_trace.lock);
+    i64 n = devfs_read_text(tmp, len, buf, count, off);
+    kfree(tmp, 1);
+    return n;
+}
+
+/* "1" clears the trace and starts it, "0" stops it */
+static i64 schedtrace_write(struct vfs_file *f, const void *buf, u64 count, vfs_off_t *off)
+{
+    (void)f; (void)off;
+    if (count < 1) return 0;
+    char c = *(const char *)buf;
+    if (c == '1') {
+        acquire(&lat_trace.lock);
+        lat_trace.n = 0;
+        lat_trace.enabled = 1;
+        release(&lat_trace.lock);
+    } else if (c == '0') {
+        lat_trace.enabled = 0;
+    }
+    return (i64)count;
+}
+
+static const struct vfs_file_ops schedtrace_fops = {
+    .read  = schedtrace_read,
+    .write = schedtrace_write,
+};
+
+void sched_devfs_init(void)
+{
+    devfs_register("sched", VFS_S_IFCHR | 0444, &sched_dev_fops, 0);
+    devfs_register("schedtrace", VFS_S_IFCHR | 0644, &schedtrace_fops, 0);
+}
+
+/* ---- sleep / wakeup ---- */
+
+static struct sleepq *sleepq_for(void *chan)
+{
+    u64 h = (u64)chan;
+    h ^= h >> 17;
+    h *= 0x9E3779B97F4A7C15UL;
+    return &sleepqs[h >> 58];   // top 6 bits: SLEEPQ_HASH == 64
+}
+
+/* Lock order: lk -> sleepq -> runq.  The runq lock is taken before the
+   sleepq lock is dropped, so a waker queueing us here blocks until we are
+   switched out.  One queueing us on another CPU does not: that CPU waits
+   for on_cpu, and ours leaves us alone as we did not yield. */
+void sleep(void *chan, struct spinlock *lk)
+{
+    struct proc *p = current_proc;
+    if (!p) panic("sleep: no process");
+    struct sleepq *sq = sleepq_for(chan);
+
+    acquire(&sq->lock);
+    if (lk) release(lk);
+
+    p->chan    = chan;
+    p->state   = PROC_SLEEPING;
+    p->wq_next = 0;
+    struct proc **pp = &sq->head;       /* FIFO: wakeup_one takes the oldest */
+    while (*pp) pp = &(*pp)->wq_next;
+    *pp = p;
+
+    acquire(&this_runq()->lock);
+    release(&sq->lock);
+    p->ru.nvcsw++;
+    sched();
+    release(&this_runq()->lock);
+
+    if (lk) acquire(lk);
+}
+
+static void wake_chan(void *chan, int all)
+{
+    struct sleepq *sq = sleepq_for(chan);
+    acquire(&sq->lock);
+    struct proc **pp = &sq->head;
+    while (*pp) {
+        struct proc *p = *pp;
+        if (p->chan != chan) { pp = &p->wq_next; continue; }
+        *pp = p->wq_next;
+        p->wq_next = 0;
+        p->chan    = 0;
+        p->wakeup_ts = sched_clock();
+        p->waker_cpu = mycpu()->cpu_id;
+        sched_enqueue(p, ENQUEUE_WAKEUP);
+        if (!all) break;
+    }
+    release(&sq->lock);
+}
+
+void wakeup(void *chan)     { wake_chan(chan, 1); }
+void wakeup_one(void *chan) { wake_chan(chan, 0); }
+
+/* ---- switching ---- */
+
+void sched(void)
+{
+    struct cpu *c = mycpu();
+    struct proc *p = c->proc;
+    if (!holding(&runqs[c->cpu_id].lock)) panic("sched: runq not locked");
+    if (c->ncli != 1) panic("sched: locks held");
+    if (c->preempt_count != 1) panic("sched: in interrupt");
+    if (p->state == PROC_RUNNING) panic("sched: still running");
+
+    /* intena belongs to this kernel thread, not to the CPU it resumes on */
+    u8 intena = c->intena;
+    swtch(&p->context, c->scheduler_ctx);
+    mycpu()->intena = intena;
+}
+
+void yield(void)
+{
+    struct cpu *c = mycpu();
+    struct proc *p = c->proc;
+    if (!p) return;
+    struct runq *rq = &runqs[c->cpu_id];
+    acquire(&rq->lock);
+    if (!rq->nr_running &&      /* nobody waiting: keep the CPU */
+        cpumask_test(&p->cpus_allowed, c->cpu_id)) {
+        resched_done(rq);
+        release(&rq->lock);
+        return;
+    }
+    p->state   = PROC_RUNNABLE;
+    p->yielded = 1;             /* requeued by the scheduler */
+    p->ru.nivcsw++;
+    sched();
+    release(&this_runq()->lock);
+}
+
+/* Interrupts are off in syscalls and on interrupt return, so mycpu()
+   cannot change under us; a kernel thread may be preempted after the
+   check, which is harmless. */
+void cond_resched(void)
+{
+    struct cpu *c = mycpu();
+    if (c->preempt_count || !c->proc || !runqs[c->cpu_id].need_resched) return;
+    yield();
+}
+
+void scheduler(void)
+{
+    struct cpu *c = mycpu();
+    struct runq *rq = &runqs[c->cpu_id];
+    for (;;) {
+        sti();
+        acquire(&rq->lock);
+        struct proc *p = pick_next(rq);
+        if (p) runq_remove(rq, p);
+        if (p && !cpumask_test(&p->cpus_allowed, c->cpu_id)) {
+            /* affinity changed while it was queued here */
+            release(&rq->lock);
+            sched_enqueue(p, ENQUEUE_WAKEUP);
+            continue;
+        }
+        if (!p) {
+            if (rq->tick_armed) tick_disarm(rq);
+            release(&rq->lock);
+            p = steal_task(c->cpu_id);
+            if (!p) {
+                /* tickless idle: only a kick, a timer we armed or a device
+                   interrupt wakes us */
+                cli();
+                if (!rq->nr_running) cpu_idle(rq);
+                continue;
+            }
+            acquire(&rq->lock);
+        }
+
+        /* a task woken onto us may still be switching out elsewhere */
+        while (__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE))
+            pause();
+
+        p->state  = PROC_RUNNING;
+        p->cpu    = c->cpu_id;
+        p->on_cpu = 1;
+        c->proc   = p;
+        resched_done(rq);
+        rq->nr_switches++;
+        rq->rq_len_sum += rq->nr_running;
+        if (rq->nr_running > rq->rq_len_max) rq->rq_len_max = rq->nr_running;
+        rq->curr_rt_prio = p->rt_priority;
+        set_next(rq, p);
+        update_min_vruntime(rq, rt_task(p) ? 0 : p);
+
+        if (p->mm) lcr3(VIRT_TO_PHYS((u64)p->mm->pml4));
+        else         load_kernel_pml4();    /* kernel thread */
+        tss_set_rsp0((u64)p->kstack + KSTACK_SIZE);
+        c->kernel_rsp = (u64)p->kstack + KSTACK_SIZE;
+        fpu_switch_in(p);
+
+        /* fresh slice, if anyone is waiting for the CPU after p */
+        if (rq->nr_running)     tick_arm(rq, SCHED_SLICE_NS);
+        else if (rq->tick_armed) tick_disarm(rq);
+
+        swtch(&c->scheduler_ctx, p->context);
+
+        /* p is off its stack now; an exited one may be reaped at once */
+        c->proc = 0;
+        rq->curr_rt_prio = 0;
+        update_curr(rq, p);
+        p->ru.stime_ns += p->exec_start - p->acct_ts;   /* switched out in the kernel */
+        fpu_switch_out(p);
+        /* Only a task that yielded is ours to requeue.  A sleeper is
+           RUNNABLE here too if it was woken while switching out, but its
+           waker has already queued it, possibly on another CPU. */
+        int moved = 0;
+        if (p->yielded) {
+            p->yielded = 0;
+            if (!cpumask_test(&p->cpus_allowed, c->cpu_id))
+                moved = 1;      /* no longer allowed here */
+            else if (rt_task(p))    /* preempted: front of its level, unless RR ran out */
+                runq_insert_rt(rq, p, p->policy == SCHED_FIFO || p->rt_slice);
+            else
+                runq_insert(rq, p);
+        }
+        p->last_ran = rdtsc();
+        /* its mm may be freed by the reaper */
+        if (p->state == PROC_ZOMBIE || p->state == PROC_DEAD) load_kernel_pml4();
+        __atomic_store_n(&p->on_cpu, 0, __ATOMIC_RELEASE);
+        release(&rq->lock);
+        if (moved) sched_enqueue(p, ENQUEUE_WAKEUP);
+    }
+}
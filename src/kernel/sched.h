@@ -0,0 +1,180 @@
+#pragma once
+#include "types.h"
+#include "spinlock.h"
+#include "rbtree.h"
+#include "cpumask.h"
+#include "list.h"
+#include "timer.h"
+
+struct proc;
+
+// Scheduling policies (Linux numbering)
+#define SCHED_NORMAL 0      // fair share by vruntime
+#define SCHED_FIFO   1      // fixed priority, runs until it blocks
+#define SCHED_RR     2      // fixed priority, round robin within a level
+
+// Real-time priorities: higher runs first; all are above SCHED_NORMAL
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 99
+#define SCHED_RT_BITMAP_WORDS ((SCHED_RT_PRIO_MAX + 64) / 64)
+
+// Latency histograms: bucket 0 counts waits under 1 us, bucket n those
+// of [2^(n-1), 2^n) us; the last is open-ended (262 ms and up)
+#define SCHED_LAT_BUCKETS 20
+
+struct lat_hist {
+    u32 count[SCHED_LAT_BUCKETS];
+    u64 sum_ns;
+    u64 max_ns;
+};
+
+/* Per-CPU run queue of PROC_RUNNABLE processes (the running one is
+   cpu->proc, not queued): real-time ones in a FIFO per priority, the rest
+   ordered by virtual runtime.  nr_running counts both.  The lock is also
+   held across every switch into and out of that CPU's scheduler: whoever
+   resumes releases it. */
+struct runq {
+    struct spinlock lock;
+    struct rb_root tasks;    // SCHED_NORMAL, keyed by proc->vruntime
+    u64 min_vruntime;        // monotonic floor of queued/running vruntimes
+    struct list_head rt_queue[SCHED_RT_PRIO_MAX + 1]; // by rt_priority
+    u64 rt_bitmap[SCHED_RT_BITMAP_WORDS]; // bit n: rt_queue[n] not empty
+    u32 rt_nr_running;       // queued real-time tasks
+    volatile u32 curr_rt_prio; // rt_priority of the running task, 0 if fair/idle
+    u64 rt_time;             // ns real-time tasks ran this period
+    u64 rt_period_start;
+    int rt_throttled;        // rt_time hit its budget: fair tasks go first
+    u64 nr_rt_throttled;     // periods that hit the budget
+    volatile u32 nr_running;
+    int need_resched;        // preempt cpu->proc at its next safe point
+    u64 resched_at;          // TSC when need_resched was set
+    u64 resched_max_ns;      // worst need_resched -> switch latency
+    u64 resched_sum_ns;
+    u64 nr_resched;
+    u64 nr_switches;         // tasks switched in
+    u64 rq_len_sum;          // nr_running left behind, summed per switch
+    u32 rq_len_max;
+    struct lat_hist wakeup_lat; // wakeup -> run, tasks that ran here
+    u64 ticks;           // timer ticks taken on this CPU
+    u64 nr_migrations;   // tasks pulled onto this CPU from another
+    u64 nr_idle;         // times this CPU halted with nothing to run
+    u64 idle_ns;         // time spent halted
+    u64 nr_poll_wakes;   // kicks that woke it from mwait without an IPI
+    u64 nr_kicks;        // IPI_KICKs sent to it
+    u64 nr_kicks_coalesced; // kicks dropped: one was already in flight
+    volatile u32 kick_pending; // IPI_KICK sent, handler not yet run
+    int tick_armed;      // slice timer pending (owning CPU programs it)
+    struct hrtimer tick_timer;
+    // Set while the CPU sits in mwait watching it; clearing it wakes the
+    // CPU.  Alone on its cache line so lock traffic does not.
+    volatile u32 idle_poll __attribute__((aligned(64)));
+};
+
+// A task that ran within this many TSC cycles is cache-hot: leave it be
+#define SCHED_CACHE_HOT_CYCLES  2000000UL
+// Timer ticks between periodic load-balancing passes
+#define SCHED_BALANCE_TICKS     8
+// Time slice. The timer is one-shot and only armed while a task is
+// queued behind the running one; idle and lone-task CPUs take no ticks.
+#define SCHED_SLICE_NS          4000000UL
+// A waking task preempts the current one if it is this far behind it
+#define SCHED_WAKEUP_GRAN_NS    1000000UL
+// How far below min_vruntime a long sleeper may be placed on wakeup
+#define SCHED_SLEEPER_CREDIT_NS (SCHED_SLICE_NS / 2)
+// Real-time tasks may use SCHED_RT_RUNTIME_NS of every SCHED_RT_PERIOD_NS
+// on a CPU while fair tasks are waiting there, so a runaway one cannot
+// lock the rest out
+#define SCHED_RT_PERIOD_NS      1000000000UL
+#define SCHED_RT_RUNTIME_NS     950000000UL
+// SCHED_RR time slice
+#define SCHED_RR_SLICE_NS       100000000UL
+// Worst wakeup latencies kept by /dev/schedtrace
+#define SCHED_TRACE_MAX         16
+// MWAIT hint for an idle CPU: C1, the shallowest state, for fast wakeups
+#define SCHED_IDLE_MWAIT_HINT   0
+
+// Weight of a nice-0 task; vruntime advances at NICE_0_WEIGHT/weight
+#define NICE_0_WEIGHT 1024
+#define NICE_MIN      (-20)
+#define NICE_MAX      19
+
+// sched_enqueue placement
+#define ENQUEUE_NEW    0   // fresh task: start one slice behind min_vruntime
+#define ENQUEUE_WAKEUP 1   // woken sleeper: bounded credit, may preempt
+
+struct runq *cpu_runq(u32 cpu_id);
+#define this_runq() cpu_runq(mycpu()->cpu_id)
+
+// Initialize all run queues (call once on the BSP)
+void sched_init(void);
+
+// Build the SMT-sibling and shared-cache sets from struct cpu (BSP, once
+// every CPU has run cpu_topology_detect)
+void sched_topology_init(void);
+
+// Reserve the CPUs in list ("2-3,6": the isolcpus= boot option) for
+// tasks pinned there.  A CPU running one task takes no ticks anyway;
+// isolation also keeps new tasks, load balancing and stealing off it.
+// Call once all CPUs are counted, before the first task is created.
+void sched_isolate_cpus(const char *list);
+
+// Pick a CPU in allowed for a newly created process
+u32 sched_select_cpu(const cpumask_t *allowed);
+
+// Initialize scheduling state of a new task (parent may be 0)
+void sched_fork(struct proc *p, struct proc *parent);
+
+// Mark p PROC_RUNNABLE and queue it on p->cpu (ENQUEUE_*)
+void sched_enqueue(struct proc *p, int flags);
+
+// Replace p's CPU affinity; moves p off a CPU no longer in mask
+void sched_set_affinity(struct proc *p, const cpumask_t *mask);
+
+// Set p's nice value (clamped to NICE_MIN..NICE_MAX)
+void sched_set_nice(struct proc *p, i32 nice);
+
+// Set p's policy (SCHED_*) and real-time priority (SCHED_RT_PRIO_MIN..MAX
+// for FIFO/RR, 0 for NORMAL); returns 0 or -1 if they are invalid
+int sched_set_policy(struct proc *p, u32 policy, u32 prio);
+
+// IPI_KICK handler: re-arm the tick if work was queued here remotely.
+// Kicks sent while one is pending are folded into it.
+void sched_kick(void);
+
+// cpu itself, or for an isolated one the housekeeping CPU that takes its
+// background work (timers): one sharing its cache if there is one
+u32 sched_housekeeping_cpu(u32 cpu);
+
+// "normal", "fifo" or "rr"
+const char *sched_policy_name(u32 policy);
+
+// Print h as "n=.. avg_us=.. max_us=.. | <bucket counts>"; returns the
+// length written
+u64 lat_hist_format(char *buf, u64 cap, const struct lat_hist *h);
+
+// Give up the CPU if a reschedule is pending: on interrupt return, and in
+// long loops in syscalls (which run with interrupts off).  A no-op under
+// a spinlock or in an interrupt handler.
+void cond_resched(void);
+
+// Register /dev/sched and /dev/schedtrace (call after devfs_init)
+void sched_devfs_init(void);
+
+// Block the current process on chan. lk (may be 0) is held by the caller,
+// released while asleep and re-acquired before returning, so a wakeup issued
+// under lk after the caller's condition check cannot be lost.
+void sleep(void *chan, struct spinlock *lk);
+
+// Make every / the longest-sleeping process blocked on chan runnable
+void wakeup(void *chan);
+void wakeup_one(void *chan);
+
+// Switch to this CPU's scheduler. Caller holds this_runq()->lock and has
+// already moved current_proc out of PROC_RUNNING.
+void sched(void);
+
+// Scheduler loop (called from kmain and ap_entry, never returns)
+void scheduler(void);
+
+// Let the next queued task run (the current one stays runnable)
+void yield(void);
@@ -0,0 +1,57 @@
+#include "slab.h"
+#include "mem.h"
+
+// Objects per refill for small sizes (bigger ones take what fits a page)
+#define SLAB_MIN_OBJS 8
+
+void kmem_cache_init(struct kmem_cache *c, const char *name, u32 size)
+{
+    initlock(&c->lock, "kmem_cache");
+    c->name = name;
+    c->size = (size + 15) & ~15u;
+    u64 bytes = (u64)c->size * SLAB_MIN_OBJS;
+    if (bytes < PAGE_SIZE) bytes = PAGE_SIZE;
+    c->slab_pages = (u32)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    c->free = 0;
+    c->nr_slabs = 0;
+    c->nr_active = 0;
+}
+
+/* Caller holds c->lock */
+static int cache_grow(struct kmem_cache *c)
+{
+    u8 *slab = kalloc(c->slab_pages);
+    if (!slab) return 0;
+    u64 n = (u64)c->slab_pages * PAGE_SIZE / c->size;
+    for (u64 i = 0; i < n; i++) {
+        void **obj = (void **)(slab + i * c->size);
+        *obj = c->free;
+        c->free = obj;
+    }
+    c->nr_slabs++;
+    return 1;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *c)
+{
+    acquire(&c->lock);
+    if (!c->free && !cache_grow(c)) {
+        release(&c->lock);
+        return 0;
+    }
+    void **obj = c->free;
+    c->free = *obj;
+    c->nr_active++;
+    release(&c->lock);
+    memset(obj, 0, c->size);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+    acquire(&c->lock);
+    *(void **)obj = c->free;
+    c->free = obj;
+    c->nr_active--;
+    release(&c->lock);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "types.h"
+#include "spinlock.h"
+
+/* Fixed-size object caches carved out of kalloc'd pages.  Freed objects
+   go back on the cache's free list; pages are kept for reuse. */
+
+struct kmem_cache {
+    struct spinlock lock;
+    const char *name;
+    u32 size;               // object size, rounded up to 16 bytes
+    u32 slab_pages;         // pages fetched from kalloc per refill
+    void *free;             // free objects, linked through their first word
+    u64 nr_slabs;
+    u64 nr_active;          // objects handed out
+};
+
+void kmem_cache_init(struct kmem_cache *c, const char *name, u32 size);
+
+// Zeroed object, or 0 when out of memory
+void *kmem_cache_alloc(struct kmem_cache *c);
+void kmem_cache_free(struct kmem_cache *c, void *obj);
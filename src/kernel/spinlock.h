@@ -17,8 +17,22 @@ struct cpu {
   u8 ncli;           // depth of pushcli nesting
   u8 intena;         // were interrupts enabled before pushcli?
   u8 cpu_id;         // index into cpus[]
+  u8 fpu_live;       // CR0.TS clear: the FPU registers are proc's
+  struct proc *fpu_owner; // last to load its state into the FPU here
+  u32 preempt_count; // pushcli depth + PREEMPT_IRQ per trap being handled
+  // Topology (cpu_topology_detect); ids are the x2APIC ID with the lower
+  // fields shifted out, so equal ids mean the same core / cache / package
+  u32 x2apic_id;
+  u32 core_id;       // SMT siblings share it
+  u32 l2_id;
+  u32 llc_id;        // last-level cache
+  u32 pkg_id;
 };
 
+// cpu->proc may only be switched out involuntarily while preempt_count is
+// 0: no spinlock held (they pushcli) and not inside an interrupt handler
+#define PREEMPT_IRQ 0x10000
+
 _Static_assert(offsetof(struct cpu, kernel_rsp) == 0, "cpu.kernel_rsp offset");
 _Static_assert(offsetof(struct cpu, scratch_rsp) == 8, "cpu.scratch_rsp offset");
 _Static_assert(offsetof(struct cpu, proc) == 16, "cpu.proc offset");
@@ -43,6 +57,7 @@ static inline void pushcli(void) {
   if (c->ncli == 0)
     c->intena = (rflags & 0x200) != 0;
   c->ncli++;
+  c->preempt_count++;
 }
 
 static inline void popcli(void) {
@@ -51,6 +66,7 @@ static inline void popcli(void) {
   struct cpu *c = mycpu();
   if (c->ncli == 0)
     hlt();  // panic: popcli underflow
+  c->preempt_count--;
   c->ncli--;
   if (c->ncli == 0 && c->intena)
     sti();
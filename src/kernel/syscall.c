@@ -1,4 +1,6 @@
 #include "syscall.h"
+#include "clock.h"
+#include "futex.h"
 #include "gdt.h"
 #include "kconsole.h"
 #include "mem.h"
@@ -29,25 +31,37 @@ static int valid_user_ptr(const void *p) { return (u64)p < USER_PTR_MAX; }
 
 /* ---- syscall implementations ---- */
 
-static void sys_exit(i32 status) {
-    struct cpu *c = mycpu();
-    struct proc *p = c->proc;
-    if (!p) return;
-    acquire_proc_lock();
+/* Every handler has the table's type: the six argument registers as u64,
+   converted inside to what the call takes.  Unused ones are ignored. */
+#define SYSCALL_UNUSED __attribute__((unused))
+#define SYSCALL_DEFINE(name)                                                  \
+    static i64 name(u64 a1 SYSCALL_UNUSED, u64 a2 SYSCALL_UNUSED,             \
+                    u64 a3 SYSCALL_UNUSED, u64 a4 SYSCALL_UNUSED,             \
+                    u64 a5 SYSCALL_UNUSED, u64 a6 SYSCALL_UNUSED)
 
-    proc_close_fds(p);
-    printf("proc: %d, code: %d\r\n", p->pid, status);
+SYSCALL_DEFINE(sys_exit) {
+    proc_exit((i32)a1);
+}
+
+SYSCALL_DEFINE(sys_exec) {
+    return proc_exec((const char *)a1, (const char *const *)a2);
+}
 
-    p->exit_code = status;
-    p->state = PROC_ZOMBIE;
+SYSCALL_DEFINE(sys_fork) {
+    return proc_fork();
+}
 
-    c->proc = 0;
-    swtch(&p->context, c->scheduler_ctx);
+SYSCALL_DEFINE(sys_vfork) {
+    return proc_vfork();
+}
 
-    panic("SYS_EXIT: RETURNED");
+SYSCALL_DEFINE(sys_nice) {
+    return proc_set_nice((u32)a1, (i32)a2);
 }
 
-static i64 sys_open(const char *path, u64 flags) {
+SYSCALL_DEFINE(sys_open) {
+    const char *path = (const char *)a1;
+    u64 flags = a2;
     struct proc *p = current_proc;
     if (!p || !valid_user_ptr(path)) return -1;
 
@@ -64,17 +78,21 @@ static i64 sys_open(const char *path, u64 flags) {
     return fd;
 }
 
-static i64 sys_close(u64 fd) {
+SYSCALL_DEFINE(sys_close) {
+    u64 fd = a1;
     struct proc *p = current_proc;
     if (!p) return -1;
-    struct vfs_file *f = fd_get(p, (i32)fd);
+    if (fd >= MAX_FDS) return -1;
+    struct vfs_file *f = fd_install(p, (i32)fd, 0);
     if (!f) return -1;
-    p->files[fd] = 0;
     vfs_close(f);
     return 0;
 }
 
-static i64 sys_read(u64 fd, void *buf, u64 len) {
+SYSCALL_DEFINE(sys_read) {
+    u64 fd = a1;
+    void *buf = (void *)a2;
+    u64 len = a3;
     struct proc *p = current_proc;
     if (!p || !valid_user_ptr(buf)) return -1;
     struct vfs_file *f = fd_get(p, (i32)fd);
@@ -82,7 +100,10 @@ static i64 sys_read(u64 fd, void *buf, u64 len) {
     return vfs_read(f, buf, (u32)len);
 }
 
-static i64 sys_write(u64 fd, const void *buf, u64 len) {
+SYSCALL_DEFINE(sys_write) {
+    u64 fd = a1;
+    const void *buf = (const void *)a2;
+    u64 len = a3;
     if (!valid_user_ptr(buf)) return -1;
 
     struct proc *p = current_proc;
@@ -96,7 +117,10 @@ static i64 sys_write(u64 fd, const void *buf, u64 len) {
     return vfs_write(f, buf, (u32)len);
 }
 
-static i64 sys_seek(u64 fd, i64 off, u64 whence) {
+SYSCALL_DEFINE(sys_seek) {
+    u64 fd = a1;
+    i64 off = (i64)a2;
+    u64 whence = a3;
     struct proc *p = current_proc;
     if (!p) return -1;
     struct vfs_file *f = fd_get(p, (i32)fd);
@@ -104,7 +128,9 @@ static i64 sys_seek(u64 fd, i64 off, u64 whence) {
     return vfs_seek(f, off, (int)whence);
 }
 
-static i64 sys_fstat(u64 fd, struct vfs_stat *st) {
+SYSCALL_DEFINE(sys_fstat) {
+    u64 fd = a1;
+    struct vfs_stat *st = (struct vfs_stat *)a2;
     struct proc *p = current_proc;
     if (!p || !valid_user_ptr(st)) return -1;
     struct vfs_file *f = fd_get(p, (i32)fd);
@@ -113,48 +139,71 @@ static i64 sys_fstat(u64 fd, struct vfs_stat *st) {
     return 0;
 }
 
-static i64 sys_stat(const char *path, struct vfs_stat *st) {
+SYSCALL_DEFINE(sys_stat) {
+    const char *path = (const char *)a1;
+    struct vfs_stat *st = (struct vfs_stat *)a2;
     if (!valid_user_ptr(path) || !valid_user_ptr(st)) return -1;
     if (vfs_stat(path, st) != VFS_OK) return -1;
     return 0;
 }
 
-static i64 sys_getpid(void) {
+SYSCALL_DEFINE(sys_getpid) {
+    if (!current_proc) return -1;
+    return (i64)current_proc->tgid;
+}
+
+SYSCALL_DEFINE(sys_gettid) {
     if (!current_proc) return -1;
     return (i64)current_proc->pid;
 }
 
-static i64 sys_wait(i32 *status_out) {
-    struct proc *parent = current_proc;
-    if (!parent) return -1;
-
-    for (;;) {
-        /* Scan for any zombie child */
-        acquire_proc_lock();
-        extern struct proc proc_table[];
-        for (int i = 0; i < MAX_PROCS; i++) {
-            struct proc *c = &proc_table[i];
-            if (c->state != PROC_ZOMBIE || c->ppid != parent->pid) continue;
-            i32 pid = (i32)c->pid;
-            if (status_out && valid_user_ptr(status_out))
-                *status_out = c->exit_code;
-            /* Reap: free address space and kstack */
-            free_user_pml4(c->pml4);
-            kfree(c->pml4, 1);
-            kfree(c->kstack, KSTACK_SIZE / PAGE_SIZE);
-            c->pml4   = 0;
-            c->kstack = 0;
-            c->state  = PROC_UNUSED;
-            release_proc_lock();
-            return pid;
-        }
-        release_proc_lock();
-        /* No zombie child yet — yield and retry */
-        yield();
-    }
+SYSCALL_DEFINE(sys_wait) {
+    i32 *status_out = (i32 *)a1;
+    struct rusage *ru_out = (struct rusage *)a2;
+    if (!current_proc) return -1;
+    if (status_out && !valid_user_ptr(status_out)) status_out = 0;
+    if (ru_out && !valid_user_ptr(ru_out)) ru_out = 0;
+    return proc_wait(status_out, ru_out);
 }
 
-static i64 sys_dup(u64 fd) {
+SYSCALL_DEFINE(sys_getrusage) {
+    i64 who = (i64)a1;
+    struct rusage *ru = (struct rusage *)a2;
+    if (!current_proc || !valid_user_ptr(ru)) return -1;
+    struct rusage k;
+    if (proc_getrusage((i32)who, &k) != 0) return -1;
+    *ru = k;
+    return 0;
+}
+
+SYSCALL_DEFINE(sys_clock_gettime) {
+    u64 clk = a1;
+    struct timespec *ts = (struct timespec *)a2;
+    if (!current_proc || !valid_user_ptr(ts)) return -1;
+    u64 ns;
+    if (clock_read((u32)clk, &ns) != 0) return -1;
+    ts->tv_sec  = (i64)(ns / NSEC_PER_SEC);
+    ts->tv_nsec = (i64)(ns % NSEC_PER_SEC);
+    return 0;
+}
+
+/* Without signals a sleep is never cut short: rem, if given, is zeroed */
+#define NANOSLEEP_MAX_SEC 0xFFFFFFFFL   // ~136 years
+SYSCALL_DEFINE(sys_nanosleep) {
+    const struct timespec *req = (const struct timespec *)a1;
+    struct timespec *rem = (struct timespec *)a2;
+    if (!current_proc || !valid_user_ptr(req)) return -1;
+    if (rem && !valid_user_ptr(rem)) return -1;
+    struct timespec t = *req;
+    if (t.tv_sec < 0 || t.tv_nsec < 0 || (u64)t.tv_nsec >= NSEC_PER_SEC) return -1;
+    if (t.tv_sec > NANOSLEEP_MAX_SEC) t.tv_sec = NANOSLEEP_MAX_SEC;
+    clock_nanosleep((u64)t.tv_sec * NSEC_PER_SEC + (u64)t.tv_nsec);
+    if (rem) rem->tv_sec = rem->tv_nsec = 0;
+    return 0;
+}
+
+SYSCALL_DEFINE(sys_dup) {
+    u64 fd = a1;
     struct proc *p = current_proc;
     if (!p) return -1;
     struct vfs_file *f = fd_get(p, (i32)fd);
@@ -165,31 +214,35 @@ static i64 sys_dup(u64 fd) {
     return new_fd;
 }
 
-static i64 sys_dup2(u64 old_fd, u64 new_fd) {
+SYSCALL_DEFINE(sys_dup2) {
+    u64 old_fd = a1;
+    u64 new_fd = a2;
     struct proc *p = current_proc;
     if (!p || new_fd >= MAX_FDS) return -1;
     struct vfs_file *f = fd_get(p, (i32)old_fd);
     if (!f) return -1;
     if (old_fd == new_fd) return (i64)new_fd;
-    /* Close existing file at new_fd */
-    if (p->files[new_fd]) {
-        vfs_close(p->files[new_fd]);
-        p->files[new_fd] = 0;
-    }
     vfs_file_get(f);
-    p->files[new_fd] = f;
+    /* Close whatever was at new_fd */
+    struct vfs_file *old = fd_install(p, (i32)new_fd, f);
+    if (old) vfs_close(old);
     return (i64)new_fd;
 }
 
-static i64 sys_brk(u64 new_brk) {
+/* The break is per address space: threads sharing an mm grow one heap */
+SYSCALL_DEFINE(sys_brk) {
+    u64 new_brk = a1;
     struct proc *p = current_proc;
-    if (!p) return -1;
-    if (new_brk == 0) return (i64)p->brk;  /* query current brk */
-
-    /* Clamp to reasonable range */
-    if (new_brk < USER_HEAP_BASE || new_brk > 0x400000000UL) return (i64)p->brk;
+    if (!p || !p->mm) return -1;
+    struct mm *mm = p->mm;
+    acquire(&mm->lock);
+    u64 old_brk = mm->brk;
+    /* 0 queries; out-of-range requests are clamped to no change */
+    if (new_brk == 0 || new_brk < USER_HEAP_BASE || new_brk > USER_HEAP_MAX) {
+        release(&mm->lock);
+        return (i64)old_brk;
+    }
 
-    u64 old_brk  = p->brk;
     u64 old_page = (old_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
     u64 new_page = (new_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 
@@ -197,17 +250,22 @@ static i64 sys_brk(u64 new_brk) {
         /* Map new pages */
         for (u64 va = old_page; va < new_page; va += PAGE_SIZE) {
             void *pg = kalloc(1);
-            if (!pg) return (i64)p->brk;  /* out of memory */
+            if (!pg) {  /* out of memory */
+                release(&mm->lock);
+                return (i64)old_brk;
+            }
             memset(pg, 0, PAGE_SIZE);
-            map_page_pml4(p->pml4, va, VIRT_TO_PHYS((u64)pg), PTE_USER | PTE_WRITE);
+            map_page_pml4(mm->pml4, va, VIRT_TO_PHYS((u64)pg), PTE_USER | PTE_WRITE);
         }
     }
     /* (shrinking: leave pages mapped — simple approach) */
-    p->brk = new_brk;
+    mm->brk = new_brk;
+    release(&mm->lock);
     return (i64)new_brk;
 }
 
-static i64 sys_pipe(i32 *fds) {
+SYSCALL_DEFINE(sys_pipe) {
+    i32 *fds = (i32 *)a1;
     if (!valid_user_ptr(fds)) return -1;
     struct proc *p = current_proc;
     if (!p) return -1;
@@ -216,7 +274,7 @@ static i64 sys_pipe(i32 *fds) {
     i32 rfd = fd_alloc(p, r);
     i32 wfd = fd_alloc(p, w);
     if (rfd < 0 || wfd < 0) {
-        if (rfd >= 0) { p->files[rfd] = 0; vfs_close(r); }
+        if (rfd >= 0) { fd_install(p, rfd, 0); vfs_close(r); }
         else vfs_close(r);
         vfs_close(w);
         return -1;
@@ -235,46 +293,160 @@ struct fb_info {
     u64 size;
 };
 
-static i64 sys_fbinfo(struct fb_info *info) {
-    if (!valid_user_ptr(info)) return -1;
-    u32 w, h, p, b;
-    kconsole_get_info(&w, &h, &p, &b);
+/* Map the framebuffer write-combining at USER_FB_BASE in the caller.
+   The frames are PTE_SHARED so exit/exec never hand them to kfree. */
+static void fb_map_user(struct proc *p)
+{
+    u64 phys = VIRT_TO_PHYS((u64)kconsole_get_addr());
+    u64 start = phys & ~(PAGE_SIZE - 1);
+    u64 end = phys + kconsole_get_size();
+    u64 flags = PTE_USER | PTE_WRITE | PTE_SHARED | mem_type_flags(MEM_WC);
+    for (u64 pa = start; pa < end; pa += PAGE_SIZE)
+        map_page_pml4(p->mm->pml4, USER_FB_BASE + (pa - start), pa, flags);
+}
+
+SYSCALL_DEFINE(sys_fbinfo) {
+    struct fb_info *info = (struct fb_info *)a1;
+    struct proc *p = current_proc;
+    if (!p || !valid_user_ptr(info)) return -1;
+    if (!kconsole_get_addr()) return -1;
+    u32 w, h, pitch, b;
+    kconsole_get_info(&w, &h, &pitch, &b);
+    fb_map_user(p);
     info->width = w;
     info->height = h;
-    info->pitch = p;
+    info->pitch = pitch;
     info->bpp = b;
-    info->addr = (u64)kconsole_get_addr();
+    info->addr = USER_FB_BASE + (VIRT_TO_PHYS((u64)kconsole_get_addr()) & (PAGE_SIZE - 1));
     info->size = kconsole_get_size();
     return 0;
 }
 
-/* Called from syscall_entry.S
-   Argument order: rdi=num, rsi=a1, rdx=a2, r10=a3, r8=a4, r9=a5 */
-i64 syscall_handler(u64 num, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5) {
-    if (num == SYS_EXIT) {
-        puts("EXIT ");
-        sys_exit((i32)a1); 
-        puts("RET ");
-        return 0;
-    }
-    (void)a4; (void)a5;
-    switch (num) {
-    case SYS_WRITE:  return sys_write(a1, (const void *)a2, a3);
-    case SYS_GETPID: return sys_getpid();
-    case SYS_EXEC:   return proc_exec((const char *)a1, (const char *const *)a2);
-    case SYS_FORK:   return proc_fork();
-    case SYS_OPEN:   return sys_open((const char *)a1, a2);
-    case SYS_CLOSE:  return sys_close(a1);
-    case SYS_READ:   return sys_read(a1, (void *)a2, a3);
-    case SYS_SEEK:   return sys_seek(a1, (i64)a2, a3);
-    case SYS_FSTAT:  return sys_fstat(a1, (struct vfs_stat *)a2);
-    case SYS_STAT:   return sys_stat((const char *)a1, (struct vfs_stat *)a2);
-    case SYS_WAIT:   return sys_wait((i32 *)a1);
-    case SYS_DUP:    return sys_dup(a1);
-    case SYS_DUP2:   return sys_dup2(a1, a2);
-    case SYS_BRK:    return sys_brk(a1);
-    case SYS_PIPE:   return sys_pipe((i32 *)a1);
-    case SYS_FBINFO: return sys_fbinfo((struct fb_info *)a1);
+SYSCALL_DEFINE(sys_clone) {
+    u64 flags = a1;
+    u64 entry = a2;
+    u64 stack = a3;
+    u64 arg = a4;
+    u64 ctid = a5;
+    if (!valid_user_ptr((void *)entry) || !valid_user_ptr((void *)stack)) return -1;
+    if ((flags & CLONE_CHILD_CLEARTID) && (!ctid || (ctid & 3) || !valid_user_ptr((void *)ctid)))
+        return -1;
+    return proc_clone(flags, entry, stack, arg, ctid);
+}
+
+SYSCALL_DEFINE(sys_futex) {
+    u32 *uaddr = (u32 *)a1;
+    u64 op = a2;
+    u64 val = a3;
+    struct proc *p = current_proc;
+    if (!p || !p->mm || !uaddr || ((u64)uaddr & 3) || !valid_user_ptr(uaddr)) return -1;
+    switch (op) {
+    case FUTEX_WAIT: return futex_wait(p->mm, (u64)uaddr, (u32)val);
+    case FUTEX_WAKE: return futex_wake(p->mm, (u64)uaddr, (u32)val);
     default:         return -1;
     }
 }
+
+SYSCALL_DEFINE(sys_spawn) {
+    const char *path = (const char *)a1;
+    const char *const *argv = (const char *const *)a2;
+    const struct spawn_action *uacts = (const struct spawn_action *)a3;
+    u64 nacts = a4;
+    if (!valid_user_ptr(path) || !valid_user_ptr(argv)) return -1;
+    if (nacts > SPAWN_MAX_ACTIONS || (nacts && !valid_user_ptr(uacts))) return -1;
+    struct spawn_action acts[SPAWN_MAX_ACTIONS];
+    memcpy(acts, uacts, nacts * sizeof(acts[0]));
+    return proc_spawn(path, argv, acts, (u32)nacts);
+}
+
+/* Masks are byte arrays, bit n = cpu n.  Bits past the kernel's
+   MAX_CPUS are ignored; getaffinity needs room for all of them. */
+SYSCALL_DEFINE(sys_sched_setaffinity) {
+    u64 pid = a1;
+    u64 len = a2;
+    const void *umask = (const void *)a3;
+    if (!current_proc || !valid_user_ptr(umask)) return -1;
+    cpumask_t mask;
+    cpumask_clear(&mask);
+    memcpy(&mask, umask, len < sizeof(mask) ? len : sizeof(mask));
+    return proc_set_affinity((u32)pid, &mask);
+}
+
+SYSCALL_DEFINE(sys_sched_getaffinity) {
+    u64 pid = a1;
+    u64 len = a2;
+    void *umask = (void *)a3;
+    if (!current_proc || !valid_user_ptr(umask) || len < sizeof(cpumask_t)) return -1;
+    cpumask_t mask;
+    if (proc_get_affinity((u32)pid, &mask) != 0) return -1;
+    memcpy(umask, &mask, sizeof(mask));
+    return (i64)sizeof(mask);
+}
+
+SYSCALL_DEFINE(sys_sched_setscheduler) {
+    u64 pid = a1;
+    u64 policy = a2;
+    u64 prio = a3;
+    if (!current_proc || policy > 0xFFFFFFFF || prio > 0xFFFFFFFF) return -1;
+    return proc_set_scheduler((u32)pid, (u32)policy, (u32)prio);
+}
+
+/* Returns the policy; the priority goes to *prio if it is given */
+SYSCALL_DEFINE(sys_sched_getscheduler) {
+    u64 pid = a1;
+    u32 *prio = (u32 *)a2;
+    if (!current_proc || (prio && !valid_user_ptr(prio))) return -1;
+    u32 k;
+    i32 policy = proc_get_scheduler((u32)pid, &k);
+    if (policy >= 0 && prio) *prio = k;
+    return policy;
+}
+
+/* Indexed by syscall number; a hole is an unknown syscall */
+typedef i64 (*syscall_fn_t)(u64, u64, u64, u64, u64, u64);
+
+static const syscall_fn_t syscall_table[NR_SYSCALLS] = {
+    [SYS_EXIT]   = sys_exit,
+    [SYS_WRITE]  = sys_write,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_EXEC]   = sys_exec,
+    [SYS_FORK]   = sys_fork,
+    [SYS_OPEN]   = sys_open,
+    [SYS_CLOSE]  = sys_close,
+    [SYS_READ]   = sys_read,
+    [SYS_SEEK]   = sys_seek,
+    [SYS_FSTAT]  = sys_fstat,
+    [SYS_STAT]   = sys_stat,
+    [SYS_WAIT]   = sys_wait,
+    [SYS_DUP]    = sys_dup,
+    [SYS_DUP2]   = sys_dup2,
+    [SYS_BRK]    = sys_brk,
+    [SYS_PIPE]   = sys_pipe,
+    [SYS_FBINFO] = sys_fbinfo,
+    [SYS_NICE]   = sys_nice,
+    [SYS_CLONE]  = sys_clone,
+    [SYS_FUTEX]  = sys_futex,
+    [SYS_GETTID] = sys_gettid,
+    [SYS_SCHED_SETAFFINITY] = sys_sched_setaffinity,
+    [SYS_SCHED_GETAFFINITY] = sys_sched_getaffinity,
+    [SYS_SPAWN]  = sys_spawn,
+    [SYS_VFORK]  = sys_vfork,
+    [SYS_GETRUSAGE] = sys_getrusage,
+    [SYS_CLOCK_GETTIME] = sys_clock_gettime,
+    [SYS_NANOSLEEP] = sys_nanosleep,
+    [SYS_SCHED_SETSCHEDULER] = sys_sched_setscheduler,
+    [SYS_SCHED_GETSCHEDULER] = sys_sched_getscheduler,
+};
+
+/* Called from syscall_entry with the user registers it saved at the top
+   of the kernel stack: rax = number, rdi/rsi/rdx/r10/r8/r9 = arguments.
+   The result goes back in tf->rax. */
+void syscall_handler(struct trap_frame *tf) {
+    acct_enter_kernel();
+    u64 num = tf->rax;
+    i64 ret = -1;
+    if (num < NR_SYSCALLS && syscall_table[num])
+        ret = syscall_table[num](tf->rdi, tf->rsi, tf->rdx, tf->r10, tf->r8, tf->r9);
+    tf->rax = (u64)ret;
+    acct_exit_kernel();
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "types.h"
+#include "idt.h"
 
 #define SYS_EXIT   0
 #define SYS_WRITE  1
@@ -18,6 +19,20 @@
 #define SYS_BRK    14
 #define SYS_PIPE   15
 #define SYS_FBINFO 16
+#define SYS_NICE   17
+#define SYS_CLONE  18
+#define SYS_FUTEX  19
+#define SYS_GETTID 20
+#define SYS_SCHED_SETAFFINITY 21
+#define SYS_SCHED_GETAFFINITY 22
+#define SYS_SPAWN  23
+#define SYS_VFORK  24
+#define SYS_GETRUSAGE 25
+#define SYS_CLOCK_GETTIME 26
+#define SYS_NANOSLEEP 27
+#define SYS_SCHED_SETSCHEDULER 28
+#define SYS_SCHED_GETSCHEDULER 29
+#define NR_SYSCALLS   30
 
 // MSR addresses
 #define MSR_EFER  0xC0000080
@@ -28,3 +43,6 @@
 #define EFER_SCE  (1UL << 0)  // syscall enable
 
 void init_syscall(void);
+
+// Entered from syscall_entry.asm with the saved user registers
+void syscall_handler(struct trap_frame *tf);
@@ -0,0 +1,374 @@
+#include "timer.h"
+#include "apic.h"
+#include "clock.h"
+#include "idt.h"
+#include "panic.h"
+#include "print.h"
+#include "proc.h"
+#include "sched.h"
+#include "spinlock.h"
+
+/* The LAPIC is never set further out than this: the count (or the TSC
+   deadline worked out from ns) would overflow.  Waking early only re-arms. */
+#define TIMER_ARM_MAX_NS (60 * NSEC_PER_SEC)
+
+#define LVL_SHIFT(lvl) ((lvl) * TIMER_LVL_SHIFT)
+#define SLOT_MASK      (TIMER_LVL_SIZE - 1)
+
+/* Wheel time counts TIMER_TICK_NS ticks.  Level l has slots of 8^l ticks
+   and takes timers due within 64 of them, so a timer goes to the finest
+   level that reaches it and is late by less than one of its slots.  A slot
+   is emptied once clk passes its end; whatever in it is not due yet (a
+   timer beyond the top level, or one a lap ahead) goes back in.
+
+   A base is only programmed and run by its own CPU.  Other CPUs add to it
+   (timers moved off isolated CPUs) and send IPI_TIMER if they need the
+   LAPIC there to fire sooner. */
+struct timer_base {
+    struct spinlock lock;
+    u64 clk;                    // ticks processed up to
+    u64 next_tick;              // no slot is due before this (~0: none)
+    u64 occupied[TIMER_LEVELS]; // bitmaps of non-empty slots
+    struct list_head slots[TIMER_LEVELS][TIMER_LVL_SIZE];
+    struct list_head expired;   // off the wheel, callback not started
+    struct rb_root hrtimers;    // by expires
+    u64 armed_at;               // ns the LAPIC is set for (~0: disarmed)
+};
+
+static struct timer_base bases[MAX_CPUS];
+
+void timer_init(void)
+{
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct timer_base *b = &bases[i];
+        initlock(&b->lock, "timer");
+        b->next_tick = ~0UL;
+        b->armed_at  = ~0UL;
+        for (int l = 0; l < TIMER_LEVELS; l++)
+            for (u32 s = 0; s < TIMER_LVL_SIZE; s++)
+                list_init(&b->slots[l][s]);
+        list_init(&b->expired);
+    }
+    klog_ok("TIMER", "%u-level wheel at %u ms, high-resolution timers",
+            (u64)TIMER_LEVELS, TIMER_TICK_NS / 1000000);
+}
+
+/* ---- wheel (caller holds b->lock) ---- */
+
+static void wheel_insert(struct timer_base *b, struct timer_list *t)
+{
+    u64 exp = (t->expires + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+    if (exp <= b->clk) exp = b->clk + 1;
+    u64 delta = exp - b->clk;
+    u32 lvl = 0;
+    while (lvl < TIMER_LEVELS - 1 && delta >= (u64)TIMER_LVL_SIZE << LVL_SHIFT(lvl))
+        lvl++;
+    u32 shift = LVL_SHIFT(lvl);
+    u64 idx  = (exp + (1UL << shift) - 1) >> shift;
+    u64 last = (b->clk >> shift) + TIMER_LVL_SIZE;
+    if (idx > last) idx = last;     /* beyond the top level: wait there */
+    u32 slot = (u32)(idx & SLOT_MASK);
+    list_add_tail(&t->entry, &b->slots[lvl][slot]);
+    b->occupied[lvl] |= 1UL << slot;
+    if (idx << shift < b->next_tick) b->next_tick = idx << shift;
+}
+
+/* A timer on the expired list has no slot to clear */
+static void wheel_remove(struct timer_base *b, struct timer_list *t)
+{
+    struct list_head *next = t->entry.next;
+    list_del(&t->entry);
+    u64 i = (u64)(next - &b->slots[0][0]);
+    if (i < TIMER_LEVELS * TIMER_LVL_SIZE && list_empty(next))
+        b->occupied[i / TIMER_LVL_SIZE] &= ~(1UL << (i % TIMER_LVL_SIZE));
+}
+
+// The first tick at which an occupied slot comes up
+static u64 wheel_next(struct timer_base *b)
+{
+    u64 next = ~0UL;
+    for (u32 lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+        u64 occ = b->occupied[lvl];
+        if (!occ) continue;
+        u32 shift = LVL_SHIFT(lvl);
+        u64 from  = (b->clk >> shift) + 1;
+        u32 start = (u32)(from & SLOT_MASK);
+        u64 rot = start ? (occ >> start) | (occ << (TIMER_LVL_SIZE - start)) : occ;
+        u64 idx = from + (u64)__builtin_ctzl(rot);
+        if (idx << shift < next) next = idx << shift;
+    }
+    return next;
+}
+
+// Move every slot that came up by now_tick to the expired list
+static void wheel_collect(struct timer_base *b, u64 now_tick)
+{
+    for (u32 lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+        u32 shift = LVL_SHIFT(lvl);
+        u64 from = (b->clk >> shift) + 1;
+        u64 to   = now_tick >> shift;
+        if (to < from) break;       /* nor has any coarser one */
+        u64 n = to - from + 1;
+        if (n > TIMER_LVL_SIZE) n = TIMER_LVL_SIZE;
+        for (u64 i = 0; i < n; i++) {
+            u32 slot = (u32)((from + i) & SLOT_MASK);
+            if (!(b->occupied[lvl] & (1UL << slot))) continue;
+            b->occupied[lvl] &= ~(1UL << slot);
+            list_splice_tail_init(&b->slots[lvl][slot], &b->expired);
+        }
+    }
+    b->clk = now_tick;
+}
+
+/* With nothing due by now, clk can skip ahead: a timer added after a long
+   idle spell is then placed by its real timeout, not a stale one. */
+static void wheel_forward(struct timer_base *b, u64 now)
+{
+    u64 now_tick = now / TIMER_TICK_NS;
+    if (now_tick > b->clk && b->next_tick > now_tick) b->clk = now_tick;
+}
+
+/* ---- programming (caller holds b->lock) ---- */
+
+// Only for the caller's own base
+static void timer_program(struct timer_base *b, u64 now)
+{
+    u64 next = b->next_tick == ~0UL ? ~0UL : b->next_tick * TIMER_TICK_NS;
+    struct rb_node *n = rb_first(&b->hrtimers);
+    if (n) {
+        u64 e = rb_entry(n, struct hrtimer, node)->expires;
+        if (e < next) next = e;
+    }
+    b->armed_at = next;
+    if (next == ~0UL) {
+        lapic_timer_disarm();
+        return;
+    }
+    u64 delta = next > now ? next - now : 0;
+    if (delta > TIMER_ARM_MAX_NS) delta = TIMER_ARM_MAX_NS;
+    lapic_timer_arm(delta);
+}
+
+/* b has something due at `due`: see that its CPU wakes by then.  Nonzero
+   if that takes an IPI, to be sent once b->lock is dropped. */
+static int timer_retarget(struct timer_base *b, u32 cpu, u64 due, u64 now)
+{
+    if (due >= b->armed_at) return 0;
+    if (cpu == mycpu()->cpu_id) {
+        timer_program(b, now);
+        return 0;
+    }
+    b->armed_at = due;      /* one IPI is enough */
+    return 1;
+}
+
+/* Lock the base a timer is queued on.  cpu only changes under the old
+   base's lock, so it is re-checked once that is held. */
+static struct timer_base *lock_base(volatile u32 *cpu)
+{
+    for (;;) {
+        u32 c = *cpu;
+        struct timer_base *b = &bases[c];
+        acquire(&b->lock);
+        if (*cpu == c) return b;
+        release(&b->lock);
+    }
+}
+
+/* ---- timer_list ---- */
+
+void add_timer(struct timer_list *t)
+{
+    if (t->pending) panic("add_timer: already pending");
+    pushcli();
+    u32 cpu = sched_housekeeping_cpu(mycpu()->cpu_id);
+    struct timer_base *b = &bases[cpu];
+    acquire(&b->lock);
+    u64 now = clock_monotonic_ns();
+    wheel_forward(b, now);
+    t->cpu     = cpu;
+    t->pending = 1;
+    wheel_insert(b, t);
+    int ipi = timer_retarget(b, cpu, b->next_tick * TIMER_TICK_NS, now);
+    release(&b->lock);
+    if (ipi) lapic_send_ipi(cpus[cpu].apic_id, IPI_TIMER);
+    popcli();
+}
+
+/* next_tick is left alone: if it goes stale that costs one early interrupt */
+int del_timer(struct timer_list *t)
+{
+    if (!t->pending) return 0;
+    struct timer_base *b = lock_base(&t->cpu);
+    int was = t->pending;
+    if (was) {
+        wheel_remove(b, t);
+        t->pending = 0;
+    }
+    release(&b->lock);
+    return was;
+}
+
+int mod_timer(struct timer_list *t, u64 expires)
+{
+    int was = del_timer(t);
+    t->expires = expires;
+    add_timer(t);
+    return was;
+}
+
+/* ---- hrtimer ---- */
+
+static void hrtimer_enqueue(struct timer_base *b, struct hrtimer *t)
+{
+    struct rb_node **link = &b->hrtimers.node, *parent = 0;
+    while (*link) {
+        parent = *link;
+        if (t->expires < rb_entry(parent, struct hrtimer, node)->expires)
+            link = &parent->left;
+        else
+            link = &parent->right;
+    }
+    rb_link_node(&t->node, parent, link);
+    rb_insert_color(&t->node, &b->hrtimers);
+    t->pending = 1;
+    if (t->expires < b->armed_at) timer_program(b, clock_monotonic_ns());
+}
+
+void hrtimer_start(struct hrtimer *t, u64 expires)
+{
+    pushcli();
+    u32 cpu = mycpu()->cpu_id;
+    if (t->pending && t->cpu != cpu) hrtimer_cancel(t);
+    struct timer_base *b = &bases[cpu];
+    acquire(&b->lock);
+    if (t->pending) rb_erase(&t->node, &b->hrtimers);
+    t->expires = expires;
+    t->cpu     = cpu;
+    hrtimer_enqueue(b, t);
+    release(&b->lock);
+    popcli();
+}
+
+/* Taking out the first timer re-arms for the next one (or disarms: the
+   tickless scheduler relies on it), but only on the timer's own CPU; a
+   remote cancel leaves that CPU one early interrupt. */
+int hrtimer_cancel(struct hrtimer *t)
+{
+    if (!t->pending) return 0;
+    struct timer_base *b = lock_base(&t->cpu);
+    int was = t->pending;
+    if (was) {
+        int first = rb_first(&b->hrtimers) == &t->node;
+        rb_erase(&t->node, &b->hrtimers);
+        t->pending = 0;
+        if (first && t->cpu == mycpu()->cpu_id)
+            timer_program(b, clock_monotonic_ns());
+    }
+    release(&b->lock);
+    return was;
+}
+
+static void hrtimer_wake(struct hrtimer *t) { wakeup(t); }
+
+/* The callback clears pending under the base lock, which is held here
+   from the check until sleep() has queued us, so the wakeup can't be
+   missed.  The timer stays on this CPU; we may come back on another. */
+void hrtimer_sleep_until(u64 expires)
+{
+    struct proc *p = current_proc;
+    struct hrtimer *t = &p->sleep_timer;
+    if (expires <= clock_monotonic_ns()) return;
+    hrtimer_init(t, hrtimer_wake);
+    pushcli();
+    u32 cpu = mycpu()->cpu_id;
+    struct timer_base *b = &bases[cpu];
+    acquire(&b->lock);
+    popcli();
+    t->expires = expires;
+    t->cpu     = cpu;
+    hrtimer_enqueue(b, t);
+    while (t->pending)
+        sleep(t, &b->lock);
+    release(&b->lock);
+}
+
+/* ---- interrupt ---- */
+
+/* Callbacks run with the lock dropped: one may re-arm its own timer, and
+   a timer may be deleted from the expired list while another runs. */
+void timer_interrupt(void)
+{
+    struct timer_base *b = &bases[mycpu()->cpu_id];
+    u64 now = clock_monotonic_ns();
+    acquire(&b->lock);
+    for (;;) {
+        struct rb_node *n = rb_first(&b->hrtimers);
+        struct hrtimer *h = n ? rb_entry(n, struct hrtimer, node) : 0;
+        if (!h || h->expires > now) break;
+        rb_erase(n, &b->hrtimers);
+        h->pending = 0;
+        hrtimer_fn_t fn = h->fn;
+        release(&b->lock);
+        fn(h);
+        acquire(&b->lock);
+    }
+
+    u64 now_tick = now / TIMER_TICK_NS;
+    if (b->next_tick <= now_tick) {
+        wheel_collect(b, now_tick);
+        b->next_tick = wheel_next(b);
+        list_for_each_safe(e, &b->expired) {
+            struct timer_list *t = list_entry(e, struct timer_list, entry);
+            if (t->expires > now) {
+                list_del(e);
+                wheel_insert(b, t);
+            }
+        }
+        while (!list_empty(&b->expired)) {
+            struct timer_list *t = list_entry(b->expired.next, struct timer_list, entry);
+            list_del(&t->entry);
+            t->pending = 0;
+            timer_fn_t fn = t->fn;
+            release(&b->lock);
+            fn(t);
+            acquire(&b->lock);
+        }
+    }
+    timer_program(b, clock_monotonic_ns());
+    release(&b->lock);
+}
+
+/* ---- isolation ---- */
+
+void timer_migrate(u32 cpu)
+{
+    u32 to = sched_housekeeping_cpu(cpu);
+    if (to == cpu) return;
+    struct timer_base *from = &bases[cpu], *b = &bases[to];
+    pushcli();
+    /* in index order, as anyone else taking two would */
+    acquire(cpu < to ? &from->lock : &b->lock);
+    acquire(cpu < to ? &b->lock : &from->lock);
+    u64 now = clock_monotonic_ns();
+    wheel_forward(b, now);
+    for (u32 lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+        for (u32 s = 0; s < TIMER_LVL_SIZE; s++) {
+            struct list_head *h = &from->slots[lvl][s];
+            while (!list_empty(h)) {
+                struct timer_list *t = list_entry(h->next, struct timer_list, entry);
+                list_del(&t->entry);
+                t->cpu = to;
+                wheel_insert(b, t);
+            }
+        }
+        from->occupied[lvl] = 0;
+    }
+    from->next_tick = ~0UL;
+    int ipi = b->next_tick != ~0UL &&
+              timer_retarget(b, to, b->next_tick * TIMER_TICK_NS, now);
+    release(&b->lock);
+    release(&from->lock);
+    if (ipi) lapic_send_ipi(cpus[to].apic_id, IPI_TIMER);
+    popcli();
+}
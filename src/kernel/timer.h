@@ -0,0 +1,90 @@
+#pragma once
+#include "types.h"
+#include "list.h"
+#include "rbtree.h"
+
+/* Kernel timers, per CPU, behind the one-shot LAPIC timer.
+
+   A struct timer_list lives in a hierarchical timer wheel: adding,
+   changing and deleting one is O(1), but it may fire up to an eighth of
+   its timeout late (at least TIMER_TICK_NS).  That suits timeouts, which
+   are mostly deleted before they fire.  A struct hrtimer is kept in a
+   red-black tree and fires on time: for sleeps and the scheduler slice.
+
+   Callbacks run in interrupt context on the timer's CPU with no timer
+   lock held.  They must not sleep; they may re-arm their own timer.
+   Callers serialize arming and deleting one timer, and deleting does not
+   wait for a callback already running elsewhere. */
+
+#define TIMER_TICK_NS    1000000UL  // wheel resolution
+#define TIMER_LVL_BITS   6
+#define TIMER_LVL_SIZE   (1U << TIMER_LVL_BITS)
+#define TIMER_LVL_SHIFT  3          // each level is 8x coarser
+#define TIMER_LEVELS     6          // the top one spans ~35 minutes; later
+                                    // timers wait there and are re-queued
+
+struct timer_list;
+typedef void (*timer_fn_t)(struct timer_list *t);
+
+struct timer_list {
+    struct list_head entry;     // wheel slot link
+    u64 expires;                // monotonic ns
+    timer_fn_t fn;
+    volatile u32 cpu;           // wheel it is (or was last) queued on
+    volatile u32 pending;       // queued, not fired yet
+};
+
+struct hrtimer;
+typedef void (*hrtimer_fn_t)(struct hrtimer *t);
+
+struct hrtimer {
+    struct rb_node node;
+    u64 expires;                // monotonic ns
+    hrtimer_fn_t fn;
+    volatile u32 cpu;
+    volatile u32 pending;
+};
+
+#define timer_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static inline void init_timer(struct timer_list *t, timer_fn_t fn)
+{
+    list_init(&t->entry);
+    t->expires = 0;
+    t->fn      = fn;
+    t->cpu     = 0;
+    t->pending = 0;
+}
+
+static inline void hrtimer_init(struct hrtimer *t, hrtimer_fn_t fn)
+{
+    t->expires = 0;
+    t->fn      = fn;
+    t->cpu     = 0;
+    t->pending = 0;
+}
+
+// Initialize the per-CPU timer bases (BSP, before any timer is armed)
+void timer_init(void);
+
+/* Wheel timers go on this CPU, or on a housekeeping CPU when this one is
+   isolated.  add_timer needs t idle; mod_timer and del_timer return
+   whether t was pending. */
+void add_timer(struct timer_list *t);
+int mod_timer(struct timer_list *t, u64 expires);
+int del_timer(struct timer_list *t);
+
+// Arm t for expires on this CPU (moving it if pending elsewhere) / disarm
+void hrtimer_start(struct hrtimer *t, u64 expires);
+int hrtimer_cancel(struct hrtimer *t);
+
+// Block the current process until the monotonic clock reaches expires
+void hrtimer_sleep_until(u64 expires);
+
+// Move the wheel timers queued on cpu to its housekeeping CPU (after it
+// was isolated)
+void timer_migrate(u32 cpu);
+
+// Timer interrupt and IPI_TIMER: run what is due, re-arm the LAPIC
+void timer_interrupt(void);
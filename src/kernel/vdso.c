@@ -0,0 +1,156 @@
+#include "vdso.h"
+#include "mem.h"
+#include "panic.h"
+#include "print.h"
+#include "proc.h"
+#include "x86.h"
+
+#define MSR_TSC_AUX 0xC0000103
+#define CPUID_81_EDX_RDTSCP (1U << 27)
+
+/* ---- user-mode code ----
+
+   Everything below up to the kernel side runs in ring 3 from a copy of
+   .vdso.text at VDSO_TEXT_VA.  It may only touch the vDSO pages (by their
+   fixed user addresses) and call within the section: no kernel data, no
+   jump tables or literals in .rodata, and helpers must be always_inline. */
+
+#define VDSO_FN     __attribute__((section(".vdso.text"), used, noinline))
+#define VDSO_INLINE static inline __attribute__((always_inline))
+
+struct vdso_timespec {
+    i64 tv_sec;
+    i64 tv_nsec;
+};
+
+VDSO_INLINE u64 vdso_rdtsc(void)
+{
+    u32 lo, hi;
+    asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((u64)hi << 32) | lo;
+}
+
+/* a * b >> 32 with a 128-bit intermediate */
+VDSO_INLINE u64 vdso_mul_shr32(u64 a, u64 b)
+{
+    u64 lo, hi;
+    asm("mulq %3" : "=a"(lo), "=d"(hi) : "a"(a), "rm"(b));
+    return (hi << 32) | (lo >> 32);
+}
+
+VDSO_FN int vdso_clock_gettime(int clk, struct vdso_timespec *ts)
+{
+    const struct vdso_data *d = (const struct vdso_data *)VDSO_DATA_VA;
+    if (!d->mult || (clk != CLOCK_REALTIME && clk != CLOCK_MONOTONIC)) return -1;
+    u32 seq;
+    u64 ns;
+    do {
+        seq = d->seq;
+        asm volatile("" : : : "memory");
+        ns = clk == CLOCK_REALTIME ? d->real_base_ns : d->mono_base_ns;
+        ns += vdso_mul_shr32(vdso_rdtsc() - d->tsc_base, d->mult);
+        asm volatile("" : : : "memory");
+    } while ((seq & 1) || seq != d->seq);
+    ts->tv_sec  = (i64)(ns / NSEC_PER_SEC);
+    ts->tv_nsec = (i64)(ns % NSEC_PER_SEC);
+    return 0;
+}
+
+VDSO_FN int vdso_getcpu(void)
+{
+    const struct vdso_data *d = (const struct vdso_data *)VDSO_DATA_VA;
+    if (!d->has_rdtscp) return -1;
+    u32 lo, hi, aux;
+    asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+    return (int)aux;
+}
+
+VDSO_FN int vdso_getpid(void)
+{
+    const struct vdso_proc *p = (const struct vdso_proc *)VDSO_PROC_VA;
+    return (int)p->pid;
+}
+
+/* ---- kernel side ---- */
+
+extern char __vdso_start[], __vdso_end[];
+
+static struct vdso_data *vdata;     // the shared page
+static u8 *vtext;                   // copy of .vdso.text
+static u32 vtext_pages;
+
+static u64 vdso_entry(void *fn)
+{
+    return VDSO_TEXT_VA + (u64)((char *)fn - __vdso_start);
+}
+
+void vdso_clock_update(u64 tsc_base, u64 mult, u64 mono_base_ns, u64 real_base_ns)
+{
+    struct vdso_data *d = vdata;
+    d->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    d->tsc_base     = tsc_base;
+    d->mult         = mult;
+    d->mono_base_ns = mono_base_ns;
+    d->real_base_ns = real_base_ns;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    d->seq++;
+}
+
+void vdso_init_cpu(void)
+{
+    if (vdata->has_rdtscp) wrmsr(MSR_TSC_AUX, mycpu()->cpu_id);
+}
+
+void vdso_init(void)
+{
+    vdata = kalloc(1);
+    vtext_pages = (u32)((__vdso_end - __vdso_start + PAGE_SIZE - 1) / PAGE_SIZE);
+    vtext = kalloc(vtext_pages);
+    if (!vdata || !vtext) panic("vdso_init: out of memory");
+    memset(vdata, 0, PAGE_SIZE);
+    memset(vtext, 0, (u64)vtext_pages * PAGE_SIZE);
+    memcpy(vtext, __vdso_start, (u64)(__vdso_end - __vdso_start));
+
+    u32 edx;
+    cpuid(0x80000001, 0, 0, 0, 0, &edx);
+    vdata->has_rdtscp    = (edx & CPUID_81_EDX_RDTSCP) != 0;
+    vdata->magic         = VDSO_MAGIC;
+    vdata->clock_gettime = vdso_entry(vdso_clock_gettime);
+    vdata->getcpu        = vdso_entry(vdso_getcpu);
+    vdata->getpid        = vdso_entry(vdso_getpid);
+    /* the clock fields are filled in by clock_select */
+    vdso_init_cpu();
+    klog_ok("VDSO", "%u code page(s) at %p, getcpu %s",
+            (u64)vtext_pages, (void *)VDSO_TEXT_VA,
+            vdata->has_rdtscp ? "via rdtscp" : "unavailable");
+}
+
+/* All frames are PTE_SHARED: exit/exec and fork leave them alone, and the
+   vdso_proc page is freed by vdso_unmap with its mm */
+int vdso_map(struct mm *mm)
+{
+    if (!mm->vdso) {
+        mm->vdso = kalloc(1);
+        if (!mm->vdso) return -1;
+        memset(mm->vdso, 0, PAGE_SIZE);
+    }
+    u64 flags = PTE_USER | PTE_SHARED;
+    map_page_pml4(mm->pml4, VDSO_DATA_VA, VIRT_TO_PHYS((u64)vdata), flags);
+    map_page_pml4(mm->pml4, VDSO_PROC_VA, VIRT_TO_PHYS((u64)mm->vdso), flags);
+    for (u32 i = 0; i < vtext_pages; i++)
+        map_page_pml4(mm->pml4, VDSO_TEXT_VA + (u64)i * PAGE_SIZE,
+                      VIRT_TO_PHYS((u64)vtext + (u64)i * PAGE_SIZE), flags);
+    return 0;
+}
+
+void vdso_unmap(struct mm *mm)
+{
+    if (mm->vdso) kfree(mm->vdso, 1);
+    mm->vdso = 0;
+}
+
+void vdso_set_pid(struct mm *mm, u32 pid)
+{
+    mm->vdso->pid = pid;
+}
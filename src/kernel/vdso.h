@@ -0,0 +1,64 @@
+#pragma once
+#include "types.h"
+#include "clock.h"
+
+/* The vDSO: pages mapped read-only into every user address space so that
+   hot queries need no syscall.
+
+     USER_VDSO_BASE + 0      struct vdso_data, shared by everyone
+     USER_VDSO_BASE + 4K     struct vdso_proc, one per address space
+     USER_VDSO_BASE + 8K...  code, copied from the kernel's .vdso.text
+
+   Processes find vdso_data through the AT_VDSO_DATA auxv entry; it lists
+   the code entry points, so user space needs no ELF parsing. */
+
+struct mm;
+
+#define USER_VDSO_BASE  0x7FFFF00000UL
+#define VDSO_DATA_VA    USER_VDSO_BASE
+#define VDSO_PROC_VA    (USER_VDSO_BASE + 0x1000)
+#define VDSO_TEXT_VA    (USER_VDSO_BASE + 0x2000)
+
+#define VDSO_MAGIC      0x4F534456534F454AUL   // "JEOSVDSO"
+
+// Auxiliary vector keys placed after envp (Linux values, plus our own)
+#define AT_NULL       0
+#define AT_PAGESZ     6
+#define AT_ENTRY      9
+#define AT_VDSO_DATA  0x1000    // address of struct vdso_data
+
+/* Clock fields are under a sequence count: readers retry while it is odd
+   or changed under them.  ns = base + (rdtsc - tsc_base) * mult >> 32.
+   mult stays 0 unless the clocksource is the TSC: clock_gettime then
+   fails and callers make the syscall, as they do for the CPU-time clocks. */
+struct vdso_data {
+    u64 magic;
+    u64 clock_gettime;      // int (*)(int clk, struct timespec *)
+    u64 getcpu;             // int (*)(void)
+    u64 getpid;             // int (*)(void); 0 means "ask the kernel"
+    volatile u32 seq;
+    u32 has_rdtscp;         // getcpu works (TSC_AUX holds the CPU number)
+    u64 tsc_base;
+    u64 mult;
+    u64 mono_base_ns;       // CLOCK_MONOTONIC at tsc_base
+    u64 real_base_ns;       // CLOCK_REALTIME at tsc_base
+};
+
+struct vdso_proc {
+    volatile u32 pid;       // tgid of the sole owner of this mm, else 0
+};
+
+// Build the shared pages (BSP, after lapic_timer_calibrate)
+void vdso_init(void);
+// Per-CPU part: TSC_AUX = cpu id for getcpu (every CPU)
+void vdso_init_cpu(void);
+
+// Map the vDSO into mm (allocating its vdso_proc page); 0 or -1
+int vdso_map(struct mm *mm);
+// Free mm's vdso_proc page (its page table is already torn down)
+void vdso_unmap(struct mm *mm);
+// Publish pid as the owner of mm, or 0 while several processes share it
+void vdso_set_pid(struct mm *mm, u32 pid);
+
+// Move the clocks (seqcount-protected against vDSO readers)
+void vdso_clock_update(u64 tsc_base, u64 mult, u64 mono_base_ns, u64 real_base_ns);
@@ -1,5 +1,6 @@
 #include "vfs.h"
 #include "mem.h"
+#include "proc.h"
 #include "string.h"
 
 /* ----------------------------- globals ----------------------------- */
@@ -569,7 +570,9 @@ i64 vfs_read(struct vfs_file *f, void *buf, u64 count)
   if (!f || !buf) return VFS_EINVAL;
   if (!f->fops || !f->fops->read) return VFS_ENOSYS;
 
-  return f->fops->read(f, buf, count, &f->pos);
+  i64 n = f->fops->read(f, buf, count, &f->pos);
+  if (n > 0 && current_proc) current_proc->ru.read_bytes += (u64)n;
+  return n;
 }
 
 i64 vfs_write(struct vfs_file *f, const void *buf, u64 count)
@@ -577,7 +580,9 @@ i64 vfs_write(struct vfs_file *f, const void *buf, u64 count)
   if (!f || !buf) return VFS_EINVAL;
   if (!f->fops || !f->fops->write) return VFS_ENOSYS;
 
-  return f->fops->write(f, buf, count, &f->pos);
+  i64 n = f->fops->write(f, buf, count, &f->pos);
+  if (n > 0 && current_proc) current_proc->ru.write_bytes += (u64)n;
+  return n;
 }
 
 vfs_off_t vfs_seek(struct vfs_file *f, vfs_off_t off, i32 whence)
@@ -0,0 +1,92 @@
+#include "workqueue.h"
+#include "print.h"
+#include "proc.h"
+
+struct workqueue {
+    struct spinlock lock;
+    struct work *head;
+    struct work *tail;
+    struct work *running;   // fn in progress (flush_work waits for it)
+    struct proc *worker;
+};
+
+static struct workqueue wqs[MAX_CPUS];
+
+void workqueue_init(void)
+{
+    for (int i = 0; i < MAX_CPUS; i++) {
+        initlock(&wqs[i].lock, "workqueue");
+        wqs[i].head = wqs[i].tail = 0;
+        wqs[i].running = 0;
+        wqs[i].worker  = 0;
+    }
+}
+
+int queue_work_on(u32 cpu, struct work *w)
+{
+    struct workqueue *wq = &wqs[cpu];
+    acquire(&wq->lock);
+    if (w->pending) {
+        release(&wq->lock);
+        return 0;
+    }
+    w->pending = 1;
+    w->cpu     = cpu;
+    w->next    = 0;
+    if (wq->tail) wq->tail->next = w;
+    else          wq->head = w;
+    wq->tail = w;
+    wakeup_one(wq);
+    release(&wq->lock);
+    return 1;
+}
+
+int queue_work(struct work *w)
+{
+    return queue_work_on(mycpu()->cpu_id, w);
+}
+
+/* Items only ever wait on the queue they were put on, so w->cpu names the
+   lock that orders pending/running against the worker. */
+void flush_work(struct work *w)
+{
+    struct workqueue *wq = &wqs[w->cpu];
+    acquire(&wq->lock);
+    while (w->pending || wq->running == w)
+        sleep(w, &wq->lock);
+    release(&wq->lock);
+}
+
+static void worker_main(void *arg)
+{
+    struct workqueue *wq = arg;
+    acquire(&wq->lock);
+    for (;;) {
+        while (!wq->head)
+            sleep(wq, &wq->lock);
+        struct work *w = wq->head;
+        wq->head = w->next;
+        if (!wq->head) wq->tail = 0;
+        w->next    = 0;
+        w->pending = 0;
+        wq->running = w;
+        release(&wq->lock);
+
+        w->fn(w);
+
+        acquire(&wq->lock);
+        wq->running = 0;
+        wakeup(w);              /* flushers; w may be gone, only its address is used */
+    }
+}
+
+void workqueue_start(void)
+{
+    for (u32 i = 0; i < ncpu; i++) {
+        char name[16];
+        ksnprintf(name, sizeof(name), "kworker/%u", (u64)i);
+        wqs[i].worker = kthread_create_on_cpu(name, worker_main, &wqs[i], i);
+        if (!wqs[i].worker) klog_fail("WQ", "no worker for cpu%u", (u64)i);
+    }
+    klog_ok("WQ", "%u worker(s) started", (u64)ncpu);
+}
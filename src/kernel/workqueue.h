@@ -0,0 +1,41 @@
+#pragma once
+#include "types.h"
+
+/* Per-CPU work queues: deferred function calls run by a kernel thread
+   bound to each CPU.  Embed a struct work in the owning object and get
+   back to it in fn with work_entry(). */
+
+struct work;
+typedef void (*work_fn_t)(struct work *w);
+
+struct work {
+    work_fn_t fn;
+    struct work *next;
+    u32 cpu;                // queue it was last put on
+    volatile u32 pending;   // queued, fn not started yet
+};
+
+#define work_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static inline void init_work(struct work *w, work_fn_t fn)
+{
+    w->fn      = fn;
+    w->next    = 0;
+    w->cpu     = 0;
+    w->pending = 0;
+}
+
+// Queue w on this CPU / on cpu. Returns 0 if it was already pending.
+// Safe from interrupt context.
+int queue_work(struct work *w);
+int queue_work_on(u32 cpu, struct work *w);
+
+// Sleep until w is neither pending nor running (process context only)
+void flush_work(struct work *w);
+
+// Initialize the queues (call once on the BSP, before any queue_work)
+void workqueue_init(void);
+
+// Start one bound worker thread per online CPU
+void workqueue_start(void);
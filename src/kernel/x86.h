@@ -3,6 +3,10 @@
 
 #define MSR_GS_BASE        0xC0000101
 #define MSR_KERNEL_GS_BASE 0xC0000102
+#define MSR_PAT            0x277
+#define MSR_TSC_DEADLINE   0x6E0
+
+#define RFLAGS_IF 0x200
 
 static inline void outb(u16 port, u8 data) {
   asm volatile("outb %b0, %w1" : : "a"(data), "Nd"(port) : "memory");
@@ -46,12 +50,39 @@ static inline void hlt(void) {
   asm volatile("hlt");
 }
 
+// Enable interrupts and halt: the sti shadow makes the pair atomic, so an
+// interrupt pending at the sti wakes the hlt instead of being missed
+static inline void sti_hlt(void) {
+  asm volatile("sti; hlt");
+}
+
+// Arm address monitoring on addr's cache line for mwait
+static inline void monitor(const volatile void *addr) {
+  asm volatile("monitor" : : "a"(addr), "c"(0), "d"(0) : "memory");
+}
+
+// Like sti_hlt, but also woken by a write to the monitored line.
+// hint selects the C-state (0 = C1).
+static inline void sti_mwait(u32 hint) {
+  asm volatile("sti; mwait" : : "a"(hint), "c"(0) : "memory");
+}
+
 static inline u64 read_rflags(void) {
   u64 rflags;
   asm volatile("pushfq; popq %0" : "=r"(rflags));
   return rflags;
 }
 
+static inline u64 rdtsc(void) {
+  u32 lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((u64)hi << 32) | lo;
+}
+
+static inline void pause(void) {
+  asm volatile("pause");
+}
+
 static inline void lcr3(u64 val) {
   asm volatile("mov %0, %%cr3" : : "r"(val) : "memory");
 }
@@ -62,6 +93,35 @@ static inline u64 rcr3(void) {
   return val;
 }
 
+static inline u64 rcr0(void) {
+  u64 val;
+  asm volatile("mov %%cr0, %0" : "=r"(val));
+  return val;
+}
+
+static inline void lcr0(u64 val) {
+  asm volatile("mov %0, %%cr0" : : "r"(val) : "memory");
+}
+
+static inline u64 rcr4(void) {
+  u64 val;
+  asm volatile("mov %%cr4, %0" : "=r"(val));
+  return val;
+}
+
+static inline void lcr4(u64 val) {
+  asm volatile("mov %0, %%cr4" : : "r"(val) : "memory");
+}
+
+// Clear CR0.TS: FPU/SSE instructions stop raising #NM
+static inline void clts(void) {
+  asm volatile("clts");
+}
+
+static inline void xsetbv(u32 reg, u64 val) {
+  asm volatile("xsetbv" : : "c"(reg), "a"((u32)val), "d"((u32)(val >> 32)));
+}
+
 static inline void wrmsr(u32 msr, u64 val) {
   u32 lo = (u32)val;
   u32 hi = (u32)(val >> 32);
@@ -74,6 +134,18 @@ static inline u64 rdmsr(u32 msr) {
   return ((u64)hi << 32) | lo;
 }
 
+static inline void cpuid(u32 leaf, u32 subleaf,
+                         u32 *a, u32 *b, u32 *c, u32 *d) {
+  u32 ra, rb, rc, rd;
+  asm volatile("cpuid"
+               : "=a"(ra), "=b"(rb), "=c"(rc), "=d"(rd)
+               : "a"(leaf), "c"(subleaf));
+  if (a) *a = ra;
+  if (b) *b = rb;
+  if (c) *c = rc;
+  if (d) *d = rd;
+}
+
 static inline u8 xchg(volatile u8 *addr, u8 newval) {
   u8 result = newval;
   asm volatile("lock; xchgb %0, %1"
@@ -0,0 +1,49 @@
+#pragma once
+#include <stddef.h>
+
+/* Coroutines ("green threads"): stackful tasks multiplexed on the thread
+   that calls co_run, switched in user space only where one yields, sleeps
+   or waits on a channel.  Stacks are carved from the heap and reused.
+   Only one thread may run tasks.  A blocking syscall in a task blocks
+   them all: there are no non-blocking fds to build on yet. */
+
+#define CO_STACK_SIZE  (16 * 1024)
+
+typedef struct co_task *co_t;
+
+/* Queue fn(arg) to run; from main or from a task.  0 or -1. */
+int co_spawn(void (*fn)(void *), void *arg);
+/* Run tasks until none can run: 0 when all have finished, else the
+   number left blocked on channels for good.  Not from inside a task. */
+int co_run(void);
+
+void co_yield(void);
+void co_sleep(unsigned long ns);    /* other tasks run meanwhile */
+void co_exit(void) __attribute__((noreturn));  /* returning from fn is the same */
+/* NULL outside a task */
+co_t co_self(void);
+
+/* A channel carries fixed-size elements between tasks, in order.  With
+   cap 0 it is unbuffered: send waits for a receiver and vice versa;
+   otherwise buf holds cap elements and send waits only when it is full. */
+struct co_waitq {
+    struct co_task *head, *tail;
+};
+
+struct co_chan {
+    char *buf;
+    size_t elem;                /* element size in bytes */
+    size_t cap;
+    size_t head, count;         /* ring of queued elements */
+    int closed;
+    struct co_waitq senders;
+    struct co_waitq receivers;
+};
+
+void co_chan_init(struct co_chan *c, size_t elem, void *buf, size_t cap);
+/* 0, or -1 if the channel is (or gets) closed before *v is taken */
+int co_chan_send(struct co_chan *c, const void *v);
+/* 0, or -1 once the channel is closed and drained */
+int co_chan_recv(struct co_chan *c, void *v);
+/* Waiting senders fail; receivers drain what is buffered, then get -1 */
+void co_chan_close(struct co_chan *c);
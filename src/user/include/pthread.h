@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+
+/* Minimal POSIX-style threads on clone() + futex().  Threads share the
+   address space, heap and fd table; stacks are carved from the heap.
+   _exit() in a thread ends only that thread. */
+
+#define PTHREAD_STACK_SIZE  (64 * 1024)
+
+typedef struct pthread *pthread_t;
+
+typedef struct {
+    int state;      /* 0 unlocked, 1 locked, 2 locked with waiters */
+} pthread_mutex_t;
+
+typedef struct {
+    int seq;        /* bumped by every signal/broadcast */
+} pthread_cond_t;
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+#define PTHREAD_COND_INITIALIZER  { 0 }
+
+/* attr must be NULL.  Returns 0 or -1. */
+int pthread_create(pthread_t *thread, const void *attr,
+                   void *(*fn)(void *), void *arg);
+int pthread_join(pthread_t thread, void **retval);
+void pthread_exit(void *retval) __attribute__((noreturn));
+/* NULL in the initial thread */
+pthread_t pthread_self(void);
+
+int pthread_mutex_init(pthread_mutex_t *m, const void *attr);
+int pthread_mutex_lock(pthread_mutex_t *m);
+int pthread_mutex_trylock(pthread_mutex_t *m);   /* 0 or -1 if held */
+int pthread_mutex_unlock(pthread_mutex_t *m);
+
+int pthread_cond_init(pthread_cond_t *c, const void *attr);
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m);
+int pthread_cond_signal(pthread_cond_t *c);
+int pthread_cond_broadcast(pthread_cond_t *c);
@@ -23,6 +23,19 @@ typedef long          off_t;
 #define SYS_BRK     14
 #define SYS_PIPE    15
 #define SYS_FBINFO  16
+#define SYS_NICE    17
+#define SYS_CLONE   18
+#define SYS_FUTEX   19
+#define SYS_GETTID  20
+#define SYS_SCHED_SETAFFINITY 21
+#define SYS_SCHED_GETAFFINITY 22
+#define SYS_SPAWN   23
+#define SYS_VFORK   24
+#define SYS_GETRUSAGE 25
+#define SYS_CLOCK_GETTIME 26
+#define SYS_NANOSLEEP 27
+#define SYS_SCHED_SETSCHEDULER 28
+#define SYS_SCHED_GETSCHEDULER 29
 
 /* ── open flags ──────────────────────────────────────────
    Low 2 bits select access mode, rest are modifiers.     */
@@ -38,6 +51,43 @@ typedef long          off_t;
 #define SEEK_CUR  1
 #define SEEK_END  2
 
+/* ── clone flags / futex ops ─────────────────────────── */
+#define CLONE_VM             0x00000100  /* share address space + brk   */
+#define CLONE_FILES          0x00000400  /* share the fd table          */
+#define CLONE_THREAD         0x00010000  /* same process (needs VM)     */
+#define CLONE_CHILD_CLEARTID 0x00200000  /* tid -> *ctid; 0 + wake at exit */
+
+#define FUTEX_WAIT  0
+#define FUTEX_WAKE  1
+
+/* ── CPU sets (bit n = cpu n) ────────────────────────── */
+#define CPU_SETSIZE 128
+typedef struct {
+    unsigned long bits[CPU_SETSIZE / 64];
+} cpu_set_t;
+
+#define CPU_ZERO(s)     do { for (int _i = 0; _i < CPU_SETSIZE / 64; _i++) (s)->bits[_i] = 0; } while (0)
+#define CPU_SET(c, s)   ((s)->bits[(c) / 64] |=  (1UL << ((c) % 64)))
+#define CPU_CLR(c, s)   ((s)->bits[(c) / 64] &= ~(1UL << ((c) % 64)))
+#define CPU_ISSET(c, s) (((s)->bits[(c) / 64] >> ((c) % 64)) & 1)
+
+/* ── clocks ──────────────────────────────────────────── */
+#define CLOCK_REALTIME  0   /* wall clock, from the RTC at boot */
+#define CLOCK_MONOTONIC 1   /* since boot, never steps          */
+#define CLOCK_PROCESS_CPUTIME_ID 2  /* CPU time of all threads      */
+#define CLOCK_THREAD_CPUTIME_ID  3  /* CPU time of the caller       */
+
+struct timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+/* ── auxiliary vector (after envp on the initial stack) ─ */
+#define AT_NULL       0
+#define AT_PAGESZ     6
+#define AT_ENTRY      9
+#define AT_VDSO_DATA  0x1000  /* JEOS: the vDSO data page       */
+
 /* ── raw syscall wrappers ─────────────────────────────── */
 static inline long syscall0(long n) {
     long r;
@@ -66,6 +116,14 @@ static inline long syscall4(long n, long a1, long a2, long a3, long a4) {
     return r;
 }
 
+static inline long syscall5(long n, long a1, long a2, long a3, long a4, long a5) {
+    long r;
+    register long r10 __asm__("r10") = a4;
+    register long r8  __asm__("r8")  = a5;
+    __asm__ volatile("syscall" : "=a"(r) : "0"(n),"D"(a1),"S"(a2),"d"(a3),"r"(r10),"r"(r8) : "rcx","r11","memory");
+    return r;
+}
+
 /* ── libc-like helpers ───────────────────────────────── */
 static inline void _exit(int code) {
     syscall1(SYS_EXIT, code);
@@ -92,8 +150,58 @@ static inline int fork(void) {
 static inline int exec(const char *path, const char **argv) {
     return (int)syscall2(SYS_EXEC, (long)path, (long)argv);
 }
+/* Like fork(), but the child borrows the caller's memory (stack included)
+   and the caller is suspended until the child calls exec() or _exit().
+   The child must do nothing else. */
+static inline int vfork(void) {
+    return (int)syscall0(SYS_VFORK);
+}
+
+/* spawn() file actions, applied in order to the child's copy of the
+   caller's fd table (at most SPAWN_MAX_ACTIONS) */
+#define SPAWN_DUP2  0   /* dup fd onto newfd */
+#define SPAWN_CLOSE 1   /* close fd          */
+#define SPAWN_MAX_ACTIONS 16
+struct spawn_action {
+    int op;
+    int fd;
+    int newfd;
+};
+
+/* Start path with argv in a new process without copying the caller;
+   returns the child pid or -1 */
+static inline int spawn(const char *path, const char **argv,
+                        const struct spawn_action *acts, int nacts) {
+    return (int)syscall4(SYS_SPAWN, (long)path, (long)argv, (long)acts, (long)nacts);
+}
+/* Resource usage; times in ns */
+struct rusage {
+    unsigned long utime_ns;     /* user mode                     */
+    unsigned long stime_ns;     /* kernel                        */
+    unsigned long nvcsw;        /* voluntary context switches    */
+    unsigned long nivcsw;       /* involuntary context switches  */
+    unsigned long read_bytes;
+    unsigned long write_bytes;
+    unsigned long blkio_ns;     /* blocked on block I/O          */
+};
+
+#define RUSAGE_SELF      0      /* all threads of this process   */
+#define RUSAGE_CHILDREN  (-1)   /* reaped children (recursively) */
+#define RUSAGE_THREAD    1      /* calling thread only           */
+
 static inline int wait(int *status) {
-    return (int)syscall1(SYS_WAIT, (long)status);
+    return (int)syscall2(SYS_WAIT, (long)status, 0);
+}
+/* wait() that also returns the reaped child's totals */
+static inline int wait_rusage(int *status, struct rusage *ru) {
+    return (int)syscall2(SYS_WAIT, (long)status, (long)ru);
+}
+static inline int getrusage(int who, struct rusage *ru) {
+    return (int)syscall2(SYS_GETRUSAGE, (long)who, (long)ru);
+}
+/* sleeps in the kernel, off the CPU; rem is zeroed (never interrupted) */
+static inline int nanosleep(const struct timespec *req, struct timespec *rem) {
+    return (int)syscall2(SYS_NANOSLEEP, (long)req, (long)rem);
 }
 static inline int dup2(int old, int newfd) {
     return (int)syscall2(SYS_DUP2, (long)old, (long)newfd);
@@ -104,15 +212,67 @@ static inline int pipe(int fds[2]) {
 static inline void *brk(void *addr) {
     return (void *)syscall1(SYS_BRK, (long)addr);
 }
-static inline int getpid(void) {
-    return (int)syscall0(SYS_GETPID);
+/* getpid() itself is in ulib: it asks the vDSO first */
+/* Set the nice value (-20..19) of pid, 0 = caller; returns 0 or -1 */
+static inline int nice(int pid, int value) {
+    return (int)syscall2(SYS_NICE, (long)pid, (long)value);
+}
+
+/* Thread id of the caller (getpid() is the id of the whole process) */
+static inline int gettid(void) {
+    return (int)syscall0(SYS_GETTID);
+}
+/* Start fn(arg) on stack (its top) in a new thread/process per flags;
+   returns the new tid. ctid is used with CLONE_CHILD_CLEARTID. */
+static inline int clone(unsigned long flags, void (*fn)(void *), void *stack,
+                        void *arg, int *ctid) {
+    return (int)syscall5(SYS_CLONE, (long)flags, (long)fn, (long)stack,
+                         (long)arg, (long)ctid);
+}
+/* FUTEX_WAIT: sleep while *uaddr == val (0 when woken, -1 if it differed)
+   FUTEX_WAKE: wake up to val waiters, returns how many */
+static inline int futex(int *uaddr, int op, int val) {
+    return (int)syscall3(SYS_FUTEX, (long)uaddr, (long)op, (long)val);
+}
+
+/* Restrict thread pid (0 = caller) to the CPUs in set; 0 or -1 */
+static inline int sched_setaffinity(int pid, size_t size, const cpu_set_t *set) {
+    return (int)syscall3(SYS_SCHED_SETAFFINITY, (long)pid, (long)size, (long)set);
+}
+/* Fill set with pid's allowed CPUs; returns the bytes written or -1 */
+static inline int sched_getaffinity(int pid, size_t size, cpu_set_t *set) {
+    CPU_ZERO(set);
+    return (int)syscall3(SYS_SCHED_GETAFFINITY, (long)pid, (long)size, (long)set);
+}
+
+/* Scheduling policies.  FIFO and RR tasks (priority 1-99, higher first)
+   run ahead of every SCHED_OTHER one, up to 95% of each second. */
+#define SCHED_OTHER 0
+#define SCHED_FIFO  1
+#define SCHED_RR    2
+
+/* Set thread pid's (0 = caller) policy; prio must be 0 for SCHED_OTHER */
+static inline int sched_setscheduler(int pid, int policy, int prio) {
+    return (int)syscall3(SYS_SCHED_SETSCHEDULER, (long)pid, (long)policy, (long)prio);
+}
+/* pid's policy, or -1 */
+static inline int sched_getscheduler(int pid) {
+    return (int)syscall2(SYS_SCHED_GETSCHEDULER, (long)pid, 0);
+}
+/* Store pid's real-time priority (0 for SCHED_OTHER); 0 or -1 */
+static inline int sched_getparam(int pid, int *prio) {
+    unsigned int p;
+    if (syscall2(SYS_SCHED_GETSCHEDULER, (long)pid, (long)&p) < 0) return -1;
+    *prio = (int)p;
+    return 0;
 }
 
+/* addr is a write-combining mapping of the framebuffer in the caller */
 struct fb_info {
-    unsigned long width;
-    unsigned long height;
-    unsigned long pitch;
-    unsigned long bpp;
+    unsigned int  width;
+    unsigned int  height;
+    unsigned int  pitch;
+    unsigned int  bpp;
     unsigned long addr;
     unsigned long size;
 };
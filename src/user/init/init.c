@@ -1,24 +1,20 @@
 #include "../include/syscall.h"
+#include "../include/ulib.h"
 
 static char *path = "/bin/jesh";
 
-void _start() {
+int main(void) {
     write(1, "init.c\n", 7);
     while (1) {
-        int pid = fork();
-        if (pid == 0) {
-            // in child
-            const char *argv[] = { path, NULL };
-            exec(path, argv);
-            write(1, "OOPS\n", 5);
-            _exit(2);
-        } else if (pid > 0) {
+        const char *argv[] = { path, NULL };
+        int pid = spawn(path, argv, NULL, 0);
+        if (pid > 0) {
             int status;
             wait(&status);
             write(1, "WAIT\n", 5);
         } else {
             write(1, "BIG OOPS\n", 9);
-            _exit(1);
+            return 1;
         }
     }
 }
@@ -5,7 +5,7 @@
 
 static int read_line(int in_fd, int out_fd, char line[LINE_MAX]);
 
-void _start() {
+int main(void) {
     int in = open("/dev/cons", O_RDONLY);
 
     for (;;) {
@@ -16,7 +16,7 @@ void _start() {
         // TODO: parse/exec line[0..n)
     }
 
-    _exit(1);
+    return 1;
 }
 
 static int read_line(int in_fd, int out_fd, char line[LINE_MAX]) {
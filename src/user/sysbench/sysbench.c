@@ -0,0 +1,94 @@
+#include "../include/syscall.h"
+#include "../include/ulib.h"
+
+/* Syscall round-trip cost in TSC cycles: a null call (an unassigned
+   number, so only entry, dispatch and exit) and getpid, against the
+   vDSO's getpid and clock_gettime, which need no syscall.  Reports the
+   fastest single call, with the timer's own cost subtracted, and the
+   mean over a batch. */
+
+#define WARMUP  1000
+#define SAMPLES 10000
+#define BATCH   100000
+#define SYS_NULL 0xFFFF
+
+/* lfence keeps rdtsc from starting early / rdtscp's read from being
+   overtaken by what follows */
+static inline unsigned long tsc_begin(void) {
+    unsigned int lo, hi;
+    __asm__ volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((unsigned long)hi << 32) | lo;
+}
+
+static inline unsigned long tsc_end(void) {
+    unsigned int lo, hi;
+    __asm__ volatile("rdtscp; lfence" : "=a"(lo), "=d"(hi) :: "rcx", "memory");
+    return ((unsigned long)hi << 32) | lo;
+}
+
+static void put_str(const char *s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    write(1, s, n);
+}
+
+static void put_u64(unsigned long v) {
+    char buf[24];
+    int i = sizeof(buf);
+    do { buf[--i] = '0' + v % 10; v /= 10; } while (v);
+    write(1, buf + i, sizeof(buf) - i);
+}
+
+static unsigned long timer_overhead(void) {
+    unsigned long best = ~0UL;
+    for (int i = 0; i < SAMPLES; i++) {
+        unsigned long t0 = tsc_begin();
+        unsigned long t1 = tsc_end();
+        if (t1 - t0 < best) best = t1 - t0;
+    }
+    return best;
+}
+
+static long sys_null(void)    { return syscall0(SYS_NULL); }
+static long sys_getpid(void)  { return syscall0(SYS_GETPID); }
+static long vdso_getpid(void) { return getpid(); }
+static long vdso_clock(void) {
+    struct timespec ts;
+    return clock_gettime(CLOCK_MONOTONIC, &ts);
+}
+
+static void bench(const char *name, long (*fn)(void), unsigned long overhead) {
+    for (int i = 0; i < WARMUP; i++) fn();
+
+    unsigned long best = ~0UL;
+    for (int i = 0; i < SAMPLES; i++) {
+        unsigned long t0 = tsc_begin();
+        fn();
+        unsigned long t1 = tsc_end();
+        if (t1 - t0 < best) best = t1 - t0;
+    }
+    best = best > overhead ? best - overhead : 0;
+
+    unsigned long t0 = tsc_begin();
+    for (int i = 0; i < BATCH; i++) fn();
+    unsigned long mean = (tsc_end() - t0) / BATCH;
+
+    put_str(name);
+    put_str(": min ");
+    put_u64(best);
+    put_str(" cycles, mean ");
+    put_u64(mean);
+    put_str(" cycles\n");
+}
+
+int main(void) {
+    unsigned long overhead = timer_overhead();
+    put_str("sysbench: timer overhead ");
+    put_u64(overhead);
+    put_str(" cycles\n");
+    bench("null         ", sys_null, overhead);
+    bench("getpid       ", sys_getpid, overhead);
+    bench("vdso getpid  ", vdso_getpid, overhead);
+    bench("clock_gettime", vdso_clock, overhead);
+    return 0;
+}
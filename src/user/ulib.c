@@ -1,5 +1,9 @@
 /* Minimal userspace runtime library */
 #include <stddef.h>
+#include <coro.h>
+#include <pthread.h>
+#include <syscall.h>
+#include <ulib.h>
 
 void *memset(void *s, int c, size_t n)
 {
@@ -28,3 +32,522 @@ int strcmp(const char *s1, const char *s2) {
     }
     return flag;
 }
+
+/* ── startup ──────────────────────────────────────────── */
+
+/* Kernel's vDSO data page (layout shared with src/kernel/vdso.h) */
+#define VDSO_MAGIC 0x4F534456534F454AUL
+struct vdso_data {
+    unsigned long magic;
+    int (*clock_gettime)(int clk, struct timespec *ts);
+    int (*getcpu)(void);
+    int (*getpid)(void);
+    /* clock state follows; only the vDSO code reads it */
+};
+
+static const struct vdso_data *vdso;
+
+/* Programs define main(), with or without arguments; the exit status is
+   its return value */
+int main(int argc, char **argv);
+
+/* rsp points at argc here, 16-byte aligned: hand it over as the argument
+   and call into C as if from a call instruction */
+__attribute__((naked)) void _start(void)
+{
+    __asm__("xor %ebp, %ebp\n\t"
+            "mov %rsp, %rdi\n\t"
+            "call __ulib_start\n\t"
+            "ud2");
+}
+
+__attribute__((used)) void __ulib_start(long *sp)
+{
+    int argc = (int)sp[0];
+    char **argv = (char **)(sp + 1);
+    char **envp = argv + argc + 1;
+    while (*envp) envp++;
+    for (unsigned long *aux = (unsigned long *)(envp + 1); aux[0] != AT_NULL; aux += 2) {
+        const struct vdso_data *d = (const struct vdso_data *)aux[1];
+        if (aux[0] == AT_VDSO_DATA && d->magic == VDSO_MAGIC)
+            vdso = d;
+    }
+    _exit(main(argc, argv));
+}
+
+/* ── vDSO-backed calls ────────────────────────────────── */
+
+/* The vDSO serves realtime and monotonic off the TSC; anything it
+   declines goes to the kernel */
+int clock_gettime(int clk, struct timespec *ts)
+{
+    if (vdso && vdso->clock_gettime(clk, ts) == 0) return 0;
+    return (int)syscall2(SYS_CLOCK_GETTIME, (long)clk, (long)ts);
+}
+
+int getcpu(void)
+{
+    return vdso ? vdso->getcpu() : -1;
+}
+
+/* The vDSO knows the pid while our address space is ours alone (not
+   after vfork or clone(CLONE_VM) without CLONE_THREAD); 0 means ask */
+int getpid(void)
+{
+    int pid = vdso ? vdso->getpid() : 0;
+    return pid ? pid : (int)syscall0(SYS_GETPID);
+}
+
+/* ── threads ──────────────────────────────────────────── */
+
+/* Each thread's descriptor sits at the top of its stack block.  Joined
+   blocks go on a free list for the next pthread_create. */
+struct pthread {
+    volatile int tid;           /* cleared + futex-woken by the kernel at exit */
+    void *(*fn)(void *);
+    void *arg;
+    void *ret;
+    struct pthread *next;       /* live list / free list */
+};
+
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pthread *live_threads;
+static struct pthread *free_threads;
+
+int pthread_mutex_init(pthread_mutex_t *m, const void *attr)
+{
+    (void)attr;
+    m->state = 0;
+    return 0;
+}
+
+/* Three-state futex mutex: unlock only enters the kernel when someone may
+   be sleeping (state 2). */
+int pthread_mutex_lock(pthread_mutex_t *m)
+{
+    int c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    if (c != 2)
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex(&m->state, FUTEX_WAIT, 2);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *m)
+{
+    int c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ? 0 : -1;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m)
+{
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+        futex(&m->state, FUTEX_WAKE, 1);
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *c, const void *attr)
+{
+    (void)attr;
+    c->seq = 0;
+    return 0;
+}
+
+/* A signal between the unlock and the futex wait changes seq, so the wait
+   returns at once instead of missing it.  Wakeups may be spurious. */
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+    int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(m);
+    futex(&c->seq, FUTEX_WAIT, seq);
+    /* relock as contended: other waiters may have been woken with us */
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+        futex(&m->state, FUTEX_WAIT, 2);
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *c)
+{
+    __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+    futex(&c->seq, FUTEX_WAKE, 1);
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *c)
+{
+    __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+    futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+    return 0;
+}
+
+/* Caller holds thread_lock (the break is shared by all threads) */
+static struct pthread *thread_alloc(void)
+{
+    struct pthread *t = free_threads;
+    if (t) {
+        free_threads = t->next;
+        return t;
+    }
+    char *base = brk(0);
+    char *end  = base + PTHREAD_STACK_SIZE;
+    if ((char *)brk(end) != end) return 0;
+    return (struct pthread *)(end - sizeof(struct pthread));
+}
+
+static void thread_start(void *arg)
+{
+    struct pthread *t = arg;
+    pthread_exit(t->fn(t->arg));
+}
+
+int pthread_create(pthread_t *thread, const void *attr,
+                   void *(*fn)(void *), void *arg)
+{
+    if (attr) return -1;
+    pthread_mutex_lock(&thread_lock);
+    struct pthread *t = thread_alloc();
+    if (!t) {
+        pthread_mutex_unlock(&thread_lock);
+        return -1;
+    }
+    t->fn   = fn;
+    t->arg  = arg;
+    t->ret  = 0;
+    t->tid  = 0;
+    t->next = live_threads;
+    live_threads = t;
+    /* the stack grows down from just below the descriptor */
+    int tid = clone(CLONE_VM | CLONE_FILES | CLONE_THREAD | CLONE_CHILD_CLEARTID,
+                    thread_start, t, t, (int *)&t->tid);
+    if (tid < 0) {
+        live_threads = t->next;
+        t->next = free_threads;
+        free_threads = t;
+        pthread_mutex_unlock(&thread_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&thread_lock);
+    *thread = t;
+    return 0;
+}
+
+int pthread_join(pthread_t t, void **retval)
+{
+    int tid;
+    while ((tid = __atomic_load_n(&t->tid, __ATOMIC_ACQUIRE)) != 0)
+        futex((int *)&t->tid, FUTEX_WAIT, tid);
+    if (retval) *retval = t->ret;
+
+    pthread_mutex_lock(&thread_lock);
+    struct pthread **pp = &live_threads;
+    while (*pp && *pp != t) pp = &(*pp)->next;
+    if (*pp) *pp = t->next;
+    t->next = free_threads;
+    free_threads = t;
+    pthread_mutex_unlock(&thread_lock);
+    return 0;
+}
+
+pthread_t pthread_self(void)
+{
+    int tid = gettid();
+    pthread_mutex_lock(&thread_lock);
+    struct pthread *t = live_threads;
+    while (t && t->tid != tid) t = t->next;
+    pthread_mutex_unlock(&thread_lock);
+    return t;
+}
+
+void pthread_exit(void *retval)
+{
+    struct pthread *t = pthread_self();
+    if (t) t->ret = retval;
+    _exit(0);
+    __builtin_unreachable();
+}
+
+/* ── coroutines ───────────────────────────────────────── */
+
+/* Each task's descriptor sits at the top of its stack block, as a
+   thread's does.  Tasks switch to the scheduler loop in co_run and back;
+   that loop also frees the blocks of finished tasks, which can't free
+   their own while running on them. */
+struct co_task {
+    unsigned long rsp;          /* saved while switched out */
+    void (*fn)(void *);
+    void *arg;
+    unsigned long wake_at;      /* co_sleep deadline, monotonic ns */
+    void *xfer;                 /* element a blocked send/recv moves */
+    int xfer_ok;                /* it was moved (else: channel closed) */
+    int done;
+    struct co_task *next;       /* run queue / sleepers / wait queue / free */
+};
+
+static struct co_waitq co_runq;
+static struct co_task *co_sleepers;     /* by wake_at, earliest first */
+static struct co_task *co_free;
+static struct co_task *co_current;
+static unsigned long co_sched_rsp;
+static int co_nr_tasks;
+
+static void co_waitq_push(struct co_waitq *q, struct co_task *t)
+{
+    t->next = 0;
+    if (q->tail) q->tail->next = t;
+    else q->head = t;
+    q->tail = t;
+}
+
+static struct co_task *co_waitq_pop(struct co_waitq *q)
+{
+    struct co_task *t = q->head;
+    if (t) {
+        q->head = t->next;
+        if (!q->head) q->tail = 0;
+    }
+    return t;
+}
+
+/* Save the callee-saved registers, MXCSR and the x87 control word on the
+   current stack, store rsp in *save and resume the stack at `to`. */
+void __co_switch(unsigned long *save, unsigned long to);
+__asm__(".pushsection .text\n"
+        ".type __co_switch, @function\n"
+        "__co_switch:\n\t"
+        "push %rbp\n\t"
+        "push %rbx\n\t"
+        "push %r12\n\t"
+        "push %r13\n\t"
+        "push %r14\n\t"
+        "push %r15\n\t"
+        "sub $8, %rsp\n\t"
+        "stmxcsr (%rsp)\n\t"
+        "fnstcw 4(%rsp)\n\t"
+        "mov %rsp, (%rdi)\n\t"
+        "mov %rsi, %rsp\n\t"
+        "ldmxcsr (%rsp)\n\t"
+        "fldcw 4(%rsp)\n\t"
+        "add $8, %rsp\n\t"
+        "pop %r15\n\t"
+        "pop %r14\n\t"
+        "pop %r13\n\t"
+        "pop %r12\n\t"
+        "pop %rbx\n\t"
+        "pop %rbp\n\t"
+        "ret\n"
+        ".popsection");
+
+/* Give the CPU back to co_run; the caller has queued itself (or not) */
+static void co_block(void)
+{
+    __co_switch(&co_current->rsp, co_sched_rsp);
+}
+
+__attribute__((used)) void __co_start(struct co_task *t)
+{
+    t->fn(t->arg);
+    co_exit();
+}
+
+/* A new task's first switch returns here with rsp 16-byte aligned, the
+   task in r12 */
+__attribute__((naked)) static void co_trampoline(void)
+{
+    __asm__("mov %r12, %rdi\n\t"
+            "call __co_start\n\t"
+            "ud2");
+}
+
+#define CO_MXCSR_DEFAULT 0x1F80UL   /* all exceptions masked */
+#define CO_FCW_DEFAULT   0x037FUL
+
+int co_spawn(void (*fn)(void *), void *arg)
+{
+    struct co_task *t = co_free;
+    if (t) {
+        co_free = t->next;
+    } else {
+        /* the break is shared with the threads */
+        pthread_mutex_lock(&thread_lock);
+        char *base = brk(0);
+        char *end  = base + CO_STACK_SIZE;
+        int ok = (char *)brk(end) == end;
+        pthread_mutex_unlock(&thread_lock);
+        if (!ok) return -1;
+        t = (struct co_task *)(((unsigned long)end - sizeof(struct co_task)) & ~15UL);
+    }
+    t->fn   = fn;
+    t->arg  = arg;
+    t->done = 0;
+
+    /* the frame __co_switch pops, from the top of the stack down */
+    unsigned long *sp = (unsigned long *)t;
+    *--sp = (unsigned long)co_trampoline;
+    *--sp = 0;                          /* rbp */
+    *--sp = 0;                          /* rbx */
+    *--sp = (unsigned long)t;           /* r12 */
+    *--sp = 0;                          /* r13 */
+    *--sp = 0;                          /* r14 */
+    *--sp = 0;                          /* r15 */
+    *--sp = CO_MXCSR_DEFAULT | CO_FCW_DEFAULT << 32;
+    t->rsp = (unsigned long)sp;
+
+    co_nr_tasks++;
+    co_waitq_push(&co_runq, t);
+    return 0;
+}
+
+co_t co_self(void)
+{
+    return co_current;
+}
+
+void co_yield(void)
+{
+    co_waitq_push(&co_runq, co_current);
+    co_block();
+}
+
+void co_exit(void)
+{
+    co_current->done = 1;
+    co_block();
+    __builtin_unreachable();
+}
+
+static unsigned long co_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+void co_sleep(unsigned long ns)
+{
+    struct co_task *t = co_current;
+    t->wake_at = co_now() + ns;
+    struct co_task **pp = &co_sleepers;
+    while (*pp && (*pp)->wake_at <= t->wake_at) pp = &(*pp)->next;
+    t->next = *pp;
+    *pp = t;
+    co_block();
+}
+
+/* With nothing runnable the whole thread sleeps until the first sleeper
+   is due, again if the sleep ends early; only channel waiters left means
+   they wait forever. */
+int co_run(void)
+{
+    for (;;) {
+        if (co_sleepers) {
+            unsigned long now = co_now();
+            if (!co_runq.head && co_sleepers->wake_at > now) {
+                unsigned long ns = co_sleepers->wake_at - now;
+                struct timespec ts = { (long)(ns / 1000000000UL), (long)(ns % 1000000000UL) };
+                nanosleep(&ts, 0);
+                now = co_now();
+            }
+            while (co_sleepers && co_sleepers->wake_at <= now) {
+                struct co_task *t = co_sleepers;
+                co_sleepers = t->next;
+                co_waitq_push(&co_runq, t);
+            }
+        }
+        struct co_task *t = co_waitq_pop(&co_runq);
+        if (!t) {
+            if (co_sleepers)
+                continue;
+            return co_nr_tasks;
+        }
+        co_current = t;
+        __co_switch(&co_sched_rsp, t->rsp);
+        co_current = 0;
+        if (t->done) {
+            co_nr_tasks--;
+            t->next = co_free;
+            co_free = t;
+        }
+    }
+}
+
+/* ── channels ─────────────────────────────────────────── */
+
+void co_chan_init(struct co_chan *c, size_t elem, void *buf, size_t cap)
+{
+    c->buf   = buf;
+    c->elem  = elem;
+    c->cap   = cap;
+    c->head  = 0;
+    c->count = 0;
+    c->closed = 0;
+    c->senders.head   = c->senders.tail   = 0;
+    c->receivers.head = c->receivers.tail = 0;
+}
+
+static void co_wake(struct co_task *t, int ok)
+{
+    t->xfer_ok = ok;
+    co_waitq_push(&co_runq, t);
+}
+
+/* A waiting receiver means the buffer is empty: hand v straight over */
+int co_chan_send(struct co_chan *c, const void *v)
+{
+    if (c->closed) return -1;
+    struct co_task *r = co_waitq_pop(&c->receivers);
+    if (r) {
+        memcpy(r->xfer, v, c->elem);
+        co_wake(r, 1);
+        return 0;
+    }
+    if (c->count < c->cap) {
+        memcpy(c->buf + (c->head + c->count) % c->cap * c->elem, v, c->elem);
+        c->count++;
+        return 0;
+    }
+    co_current->xfer = (void *)v;
+    co_waitq_push(&c->senders, co_current);
+    co_block();
+    return co_current->xfer_ok ? 0 : -1;
+}
+
+/* Taking from a full buffer makes room for the first waiting sender */
+int co_chan_recv(struct co_chan *c, void *v)
+{
+    struct co_task *s;
+    if (c->count) {
+        memcpy(v, c->buf + c->head * c->elem, c->elem);
+        c->head = (c->head + 1) % c->cap;
+        c->count--;
+        if ((s = co_waitq_pop(&c->senders))) {
+            memcpy(c->buf + (c->head + c->count) % c->cap * c->elem, s->xfer, c->elem);
+            c->count++;
+            co_wake(s, 1);
+        }
+        return 0;
+    }
+    if ((s = co_waitq_pop(&c->senders))) {
+        memcpy(v, s->xfer, c->elem);
+        co_wake(s, 1);
+        return 0;
+    }
+    if (c->closed) return -1;
+    co_current->xfer = v;
+    co_waitq_push(&c->receivers, co_current);
+    co_block();
+    return co_current->xfer_ok ? 0 : -1;
+}
+
+void co_chan_close(struct co_chan *c)
+{
+    struct co_task *t;
+    c->closed = 1;
+    while ((t = co_waitq_pop(&c->senders)))   co_wake(t, 0);
+    while ((t = co_waitq_pop(&c->receivers))) co_wake(t, 0);
+}